@@ -0,0 +1,445 @@
+#include "async_logger.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>  // NOLINT
+#include <cstdlib>
+#include <new>
+#include "stack_trace.h"
+
+namespace cbase {
+
+namespace {
+
+// Alternate stack for the crash handler, without it a stack overflow
+// kills the thread before anything is flushed. A thread that already has
+// one, e.g. from a sanitizer, keeps it.
+class CrashStack {
+public:
+    static constexpr size_t kBytes = 1 << 16;
+
+    ~CrashStack() {
+        if (m_memory == nullptr) return;
+        stack_t stack  = {};
+        stack.ss_flags = SS_DISABLE;
+        sigaltstack(&stack, nullptr);
+        delete[] m_memory;
+    }
+
+    void Install() noexcept {
+        stack_t current;
+        if (sigaltstack(nullptr, &current) != 0 ||
+            (current.ss_flags & SS_DISABLE) == 0) {
+            return;
+        }
+        m_memory = new (std::nothrow) char[kBytes];
+        if (m_memory == nullptr) return;
+        stack_t stack  = {};
+        stack.ss_sp    = m_memory;
+        stack.ss_size  = kBytes;
+        stack.ss_flags = 0;
+        if (sigaltstack(&stack, nullptr) != 0) {
+            delete[] m_memory;
+            m_memory = nullptr;
+        }
+    }
+
+private:
+    char* m_memory = nullptr;
+};
+
+thread_local CrashStack t_crash_stack;
+
+}  // namespace
+
+namespace detail {
+
+thread_local uint32_t t_log_tid = 0;
+
+uint32_t InitLogThreadId() noexcept {
+    t_log_tid = static_cast<uint32_t>(syscall(SYS_gettid));
+    // once per logging thread, the crash handler runs on the thread that
+    // crashed
+    t_crash_stack.Install();
+    return t_log_tid;
+}
+
+}  // namespace detail
+
+namespace {
+
+constexpr int kCrashSignals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+constexpr int kCrashSignalCnt =
+    sizeof(kCrashSignals) / sizeof(kCrashSignals[0]);
+struct sigaction s_previous_actions[kCrashSignalCnt];
+bool s_crash_handlers_installed = false;  // under AsyncLogger::m_mutex
+
+// the writer thread is usually done within microseconds, a crash handler
+// does not wait longer than this for it
+constexpr uint64_t kCrashDrainSpins = 1 << 24;
+
+void CrashHandler(int signo) {
+    AsyncLogger::Instance().CrashFlush(signo);
+    // hand over to whoever was installed before, the default one re-raises
+    for (int i = 0; i < kCrashSignalCnt; ++i) {
+        if (kCrashSignals[i] == signo) {
+            sigaction(signo, &s_previous_actions[i], nullptr);
+        }
+    }
+    raise(signo);
+}
+
+void InstallCrashHandlers() {
+    if (s_crash_handlers_installed) return;
+    s_crash_handlers_installed = true;
+    struct sigaction action    = {};
+    action.sa_handler          = &CrashHandler;
+    action.sa_flags            = SA_RESETHAND | SA_NODEFER | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    for (int i = 0; i < kCrashSignalCnt; ++i) {
+        sigaction(kCrashSignals[i], &action, &s_previous_actions[i]);
+    }
+}
+
+const char kLevelChars[] = "DIWEF";
+
+// civil date from days since 1970-01-01, no libc so it is fine in a
+// signal handler
+void CivilFromDays(int64_t days, int* year, int* month, int* day) {
+    days += 719468;
+    int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    int64_t doe = days - era * 146097;
+    int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int64_t mp  = (5 * doy + 2) / 153;
+    *day        = static_cast<int>(doy - (153 * mp + 2) / 5 + 1);
+    *month      = static_cast<int>(mp < 10 ? mp + 3 : mp - 9);
+    *year       = static_cast<int>(yoe + era * 400 + (*month <= 2 ? 1 : 0));
+}
+
+// formatted lines waiting for one writev
+class LineBatch {
+public:
+    static constexpr size_t kBytes = 1 << 16;
+    static constexpr int kMaxLines = 64;
+
+    LineBatch() : m_fd(-1), m_used(0), m_cnt(0), m_written(0) {}
+
+    void Reset(int fd) noexcept {
+        m_fd      = fd;
+        m_used    = 0;
+        m_cnt     = 0;
+        m_written = 0;
+    }
+
+    // room for one line of at most max_len bytes
+    char* Reserve(size_t max_len) {
+        if (m_cnt == kMaxLines || kBytes - m_used < max_len) Write();
+        return m_buffer + m_used;
+    }
+    void Commit(size_t len) {
+        m_iov[m_cnt].iov_base = m_buffer + m_used;
+        m_iov[m_cnt].iov_len  = len;
+        ++m_cnt;
+        m_used += len;
+    }
+
+    void Write() {
+        struct iovec* iov = m_iov;
+        int cnt           = m_cnt;
+        while (cnt > 0) {
+            ssize_t ret = writev(m_fd, iov, cnt);
+            if (ret < 0) {
+                if (errno == EINTR) continue;
+                break;  // nowhere to report it, the lines are lost
+            }
+            m_written += static_cast<uint64_t>(ret);
+            size_t left = static_cast<size_t>(ret);
+            while (cnt > 0 && left >= iov->iov_len) {
+                left -= iov->iov_len;
+                ++iov;
+                --cnt;
+            }
+            if (cnt > 0) {
+                iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+                iov->iov_len -= left;
+            }
+        }
+        m_used = 0;
+        m_cnt  = 0;
+    }
+
+    uint64_t Written() const noexcept { return m_written; }
+
+private:
+    int m_fd;
+    size_t m_used;
+    int m_cnt;
+    uint64_t m_written;
+    struct iovec m_iov[kMaxLines];
+    char m_buffer[kBytes];
+};
+
+// too big for the stack of a crash handler, so there is one batch, used
+// with the drain lock held
+LineBatch s_drain_batch;
+
+}  // namespace
+
+AsyncLogger& AsyncLogger::Instance() {
+    static AsyncLogger* logger = new AsyncLogger();  // never destroyed
+    return *logger;
+}
+
+AsyncLogger::AsyncLogger()
+    : m_level(static_cast<uint8_t>(LogLevel::kInfo)),
+      m_running(false),
+      m_draining(false),
+      m_overflow(LogOverflow::kDrop),
+      m_fd(STDERR_FILENO),
+      m_owns_fd(false),
+      m_written_bytes(0),
+      m_unindexed_dropped(0) {
+    for (auto& ring : m_rings) {
+        ring.store(nullptr, std::memory_order_relaxed);
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    m_base_ticks   = TscClock::NowTicks();
+    m_base_wall_ns = static_cast<int64_t>(now.tv_sec) * 1000000000 +
+                     now.tv_nsec;
+}
+
+bool AsyncLogger::Start(const std::string& path, LogOverflow overflow,
+                        int interval_ms) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (IsRunning()) return false;
+
+    int fd = STDERR_FILENO;
+    if (!path.empty()) {
+        fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                  0644);
+        if (fd < 0) return false;
+    }
+    // only a logger in use takes over the crash signals
+    InstallCrashHandlers();
+    t_crash_stack.Install();
+
+    // records logged before Start went out synchronously, nothing pending
+    LockDrain(UINT64_MAX);
+    m_fd       = fd;
+    m_owns_fd  = !path.empty();
+    m_overflow = overflow;
+    UnlockDrain();
+
+    m_running.store(true, std::memory_order_release);
+    m_writer = std::thread([this, interval_ms] {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (IsRunning()) {
+            m_cond.wait_for(lock, std::chrono::milliseconds(interval_ms));
+            lock.unlock();
+            Flush();
+            lock.lock();
+        }
+    });
+    return true;
+}
+
+void AsyncLogger::Stop() {
+    std::thread writer;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!IsRunning()) return;
+        m_running.store(false, std::memory_order_release);
+        writer.swap(m_writer);
+    }
+    m_cond.notify_all();
+    writer.join();
+
+    LockDrain(UINT64_MAX);
+    DrainAll();
+    if (m_owns_fd) close(m_fd);
+    m_fd      = STDERR_FILENO;
+    m_owns_fd = false;
+    UnlockDrain();
+}
+
+void AsyncLogger::Flush() {
+    LockDrain(UINT64_MAX);
+    DrainAll();
+    UnlockDrain();
+}
+
+AsyncLogger::Stats AsyncLogger::GetStats() const noexcept {
+    Stats stats = {0, m_unindexed_dropped.load(std::memory_order_relaxed), 0,
+                   m_written_bytes.load(std::memory_order_relaxed)};
+    for (const auto& slot : m_rings) {
+        const Ring* ring = slot.load(std::memory_order_acquire);
+        if (ring == nullptr) continue;
+        stats.m_logged += ring->m_logged.load(std::memory_order_relaxed);
+        stats.m_dropped += ring->m_dropped.load(std::memory_order_relaxed);
+        stats.m_blocked += ring->m_blocked.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+AsyncLogger::Ring* AsyncLogger::CreateRing(uint32_t index) noexcept {
+    // a ring stays with its thread index, a later thread reusing the index
+    // reuses the ring
+    Ring* ring = new Ring();
+    m_rings[index].store(ring, std::memory_order_release);
+    return ring;
+}
+
+char* AsyncLogger::Reserve(Ring* ring, uint32_t size,
+                           uint64_t* next_tail) noexcept {
+    size          = (size + 7) & ~7u;
+    uint64_t tail = ring->m_tail.load(std::memory_order_relaxed);
+    uint64_t pos  = tail % kRingBytes;
+    uint64_t room = kRingBytes - pos;
+    // a record never wraps, the end of the ring is skipped instead
+    uint64_t total = size <= room ? size : room + size;
+
+    if (tail + total - ring->m_cached_head > kRingBytes) {
+        ring->m_cached_head = ring->m_head.load(std::memory_order_acquire);
+        bool blocked        = false;
+        while (tail + total - ring->m_cached_head > kRingBytes) {
+            if (m_overflow == LogOverflow::kDrop || !IsRunning()) {
+                Increase(&ring->m_dropped);
+                return nullptr;
+            }
+            if (!blocked) Increase(&ring->m_blocked);
+            blocked = true;
+            WaitForRoom();
+            ring->m_cached_head = ring->m_head.load(std::memory_order_acquire);
+        }
+    }
+
+    if (size > room) {
+        uint32_t padding = static_cast<uint32_t>(room) |
+                           detail::LogRecord::kPadding;
+        memcpy(ring->m_buffer + pos, &padding, sizeof(padding));
+        pos = 0;
+    }
+    *next_tail = tail + total;
+    return ring->m_buffer + pos;
+}
+
+void AsyncLogger::Commit(Ring* ring, uint64_t next_tail) noexcept {
+    uint64_t tail = ring->m_tail.load(std::memory_order_relaxed);
+    ring->m_tail.store(next_tail, std::memory_order_release);
+    Increase(&ring->m_logged);
+    // wake the writer once when the ring crosses half full
+    uint64_t half = kRingBytes / 2;
+    if (tail - ring->m_cached_head < half &&
+        next_tail - ring->m_cached_head >= half) {
+        m_cond.notify_one();
+    }
+}
+
+void AsyncLogger::WaitForRoom() noexcept {
+    m_cond.notify_one();
+    std::this_thread::yield();
+}
+
+void AsyncLogger::Fatal() noexcept {
+    Flush();
+    abort();
+}
+
+bool AsyncLogger::LockDrain(uint64_t max_spins) noexcept {
+    for (uint64_t spins = 0; spins < max_spins; ++spins) {
+        if (!m_draining.load(std::memory_order_relaxed) &&
+            !m_draining.exchange(true, std::memory_order_acquire)) {
+            return true;
+        }
+        if (spins < 1024) {
+            cpu_relax();
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    return false;
+}
+
+void AsyncLogger::DrainAll() noexcept {
+    LineBatch& batch = s_drain_batch;
+    batch.Reset(m_fd);
+    for (auto& slot : m_rings) {
+        Ring* ring = slot.load(std::memory_order_acquire);
+        if (ring == nullptr) continue;
+
+        uint64_t head = ring->m_head.load(std::memory_order_relaxed);
+        uint64_t tail = ring->m_tail.load(std::memory_order_acquire);
+        while (head < tail) {
+            const char* src = ring->m_buffer + head % kRingBytes;
+            uint32_t size   = 0;
+            memcpy(&size, src, sizeof(size));
+            if (size & detail::LogRecord::kPadding) {
+                head += size & ~detail::LogRecord::kPadding;
+                continue;
+            }
+            detail::LogRecord record;
+            memcpy(&record, src, sizeof(record));
+
+            int64_t wall_ns =
+                m_base_wall_ns +
+                static_cast<int64_t>(TscClock::TicksToNanos(record.m_ticks)) -
+                static_cast<int64_t>(TscClock::TicksToNanos(m_base_ticks));
+            int64_t secs = wall_ns / 1000000000;
+            int year = 0, month = 0, day = 0;
+            CivilFromDays(secs / 86400, &year, &month, &day);
+            int64_t sod      = secs % 86400;
+            const char* file = strrchr(record.m_file, '/');
+            file             = file == nullptr ? record.m_file : file + 1;
+
+            char* line = batch.Reserve(kMaxLineBytes);
+            int len    = snprintf(
+                line, kMaxLineBytes,
+                "%04d-%02d-%02d %02d:%02d:%02d.%06d %c %u %s:%u] ", year,
+                month, day, static_cast<int>(sod / 3600),
+                static_cast<int>(sod / 60 % 60), static_cast<int>(sod % 60),
+                static_cast<int>(wall_ns % 1000000000 / 1000),
+                kLevelChars[static_cast<int>(record.m_level)], record.m_tid,
+                file, record.m_line);
+            if (len < 0) len = 0;
+            int msg = record.m_format_func(
+                line + len, kMaxLineBytes - len - 1, record.m_format,
+                src + sizeof(detail::LogRecord));
+            if (msg > 0) {
+                len += std::min(msg, static_cast<int>(kMaxLineBytes) - len - 2);
+            }
+            line[len++] = '\n';
+            batch.Commit(static_cast<size_t>(len));
+
+            head += size;
+        }
+        // the record bytes were copied into the batch
+        ring->m_head.store(head, std::memory_order_release);
+    }
+    batch.Write();
+    m_written_bytes.fetch_add(batch.Written(), std::memory_order_relaxed);
+}
+
+void AsyncLogger::CrashFlush(int signo) noexcept {
+    // a second drain next to a writer stuck mid drain would write lines
+    // twice and race on the ring heads, so then only the stack goes out
+    bool locked = LockDrain(kCrashDrainSpins);
+    if (locked) DrainAll();
+    char buf[64];
+    int len = snprintf(buf, sizeof(buf), "*** signal %d, stack:\n", signo);
+    if (write(m_fd, buf, static_cast<size_t>(len)) >= 0) {
+        void* frames[kMaxStackFrames];
+        int frame_cnt = CaptureStack(frames, kMaxStackFrames, 1);
+        WriteStack(m_fd, frames, frame_cnt);
+    }
+    if (locked) UnlockDrain();
+}
+
+}  // namespace cbase
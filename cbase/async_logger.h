@@ -0,0 +1,350 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>  // NOLINT
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>  // NOLINT
+#include <string>
+#include <thread>  // NOLINT
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include "thread_index.h"
+#include "tsc_clock.h"
+#include "utils.h"
+
+namespace cbase {
+
+enum class LogLevel : uint8_t {
+    kDebug = 0,
+    kInfo  = 1,
+    kWarn  = 2,
+    kError = 3,
+    kFatal = 4,  // flushes and aborts after logging
+};
+
+// what a thread does when its ring has no room for a record
+enum class LogOverflow {
+    kDrop,   // counted in Stats::m_dropped
+    kBlock,  // waits for the writer thread, counted in Stats::m_blocked
+};
+
+namespace detail {
+
+extern thread_local uint32_t t_log_tid;
+uint32_t InitLogThreadId() noexcept;
+
+inline uint32_t LogThreadId() noexcept {
+    uint32_t tid = t_log_tid;
+    return likely(tid != 0) ? tid : InitLogThreadId();
+}
+
+// never called, lets the compiler check the format against the arguments
+inline void CheckLogFormat(const char*, ...)
+    __attribute__((format(printf, 1, 2)));
+inline void CheckLogFormat(const char*, ...) {}
+
+// longest C string argument kept, longer ones are cut
+constexpr size_t kMaxLogStringArg = 1024;
+
+// Arguments are stored raw and only formatted by the writer thread, so
+// they must stay valid without the caller: numbers and pointers are
+// copied, C strings are copied with their bytes.
+template <class T>
+struct LogArg {
+    static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value ||
+                      std::is_pointer<T>::value,
+                  "log arguments must be numbers, pointers or C strings");
+    using Decoded = T;
+
+    static size_t Size(T) noexcept { return sizeof(T); }
+    static char* Encode(char* dst, T value) noexcept {
+        memcpy(dst, &value, sizeof(T));
+        return dst + sizeof(T);
+    }
+    static T Decode(const char** src) noexcept {
+        T value;
+        memcpy(&value, *src, sizeof(T));
+        *src += sizeof(T);
+        return value;
+    }
+};
+
+template <>
+struct LogArg<const char*> {
+    using Decoded = const char*;
+
+    static size_t Size(const char* value) noexcept {
+        return value == nullptr ? 1 : strnlen(value, kMaxLogStringArg) + 1;
+    }
+    static char* Encode(char* dst, const char* value) noexcept {
+        size_t len = Size(value) - 1;
+        if (len > 0) memcpy(dst, value, len);
+        dst[len] = '\0';
+        return dst + len + 1;
+    }
+    static const char* Decode(const char** src) noexcept {
+        const char* value = *src;
+        *src += strlen(value) + 1;
+        return value;
+    }
+};
+
+template <>
+struct LogArg<char*> : LogArg<const char*> {};
+
+template <class T>
+using LogArgOf = LogArg<typename std::decay<T>::type>;
+
+inline size_t LogArgsSize() noexcept { return 0; }
+template <class T, class... Rest>
+size_t LogArgsSize(const T& value, const Rest&... rest) noexcept {
+    return LogArgOf<T>::Size(value) + LogArgsSize(rest...);
+}
+
+inline char* EncodeLogArgs(char* dst) noexcept { return dst; }
+template <class T, class... Rest>
+char* EncodeLogArgs(char* dst, const T& value, const Rest&... rest) noexcept {
+    return EncodeLogArgs(LogArgOf<T>::Encode(dst, value), rest...);
+}
+
+template <class Tuple, size_t... I>
+int FormatLogTuple(char* out, size_t cap, const char* format,
+                   const Tuple& values, std::index_sequence<I...>) {
+    // the trailing 0 is never read, it keeps a format without arguments
+    // from being a format-security warning
+    return snprintf(out, cap, format, std::get<I>(values)..., 0);
+}
+
+// turns the stored arguments back into values and formats them, one
+// instance per argument list
+template <class... Args>
+int FormatLogRecord(char* out, size_t cap, const char* format,
+                    const char* args) {
+    (void)args;  // unused without arguments
+    // braced init decodes left to right
+    std::tuple<typename LogArg<Args>::Decoded...> values{
+        LogArg<Args>::Decode(&args)...};
+    return FormatLogTuple(out, cap, format, values,
+                          std::index_sequence_for<Args...>());
+}
+
+using LogFormatFunc = int (*)(char* out, size_t cap, const char* format,
+                              const char* args);
+
+struct LogRecord {
+    static constexpr uint32_t kPadding = 1u << 31;
+
+    // bytes of the record with its arguments, a multiple of 8. kPadding
+    // marks the unused end of the ring, only this word is written then.
+    uint32_t m_size;
+    uint32_t m_tid;
+    uint64_t m_ticks;
+    const char* m_file;
+    const char* m_format;
+    LogFormatFunc m_format_func;
+    uint32_t m_line;
+    LogLevel m_level;
+};
+
+}  // namespace detail
+
+// Asynchronous logger. A logging thread only copies the format pointer
+// and the raw arguments into its own ring, the writer thread formats the
+// records and writes them in batches with writev. Lines are ordered per
+// thread, time stamps are UTC:
+//
+//   2026-10-19 08:01:02.123456 I 4242 server.cpp:88] listening on 8080
+//
+// The format must outlive the logger, a string literal in practice; the
+// arguments may be numbers, pointers or C strings, which are copied.
+// Before Start() and after Stop() records are written by the logging
+// thread itself. Start() also takes over SIGSEGV, SIGBUS, SIGFPE, SIGILL
+// and SIGABRT: pending records are written out, on an alternate stack for
+// threads that logged, before the previous handler runs.
+class AsyncLogger {
+public:
+    static constexpr uint32_t kRingBytes    = 1 << 16;  // per thread
+    static constexpr uint32_t kMaxLineBytes = 2048;
+
+    struct Stats {
+        uint64_t m_logged;
+        uint64_t m_dropped;  // also records of threads without a ring
+        uint64_t m_blocked;  // records that had to wait for room
+        uint64_t m_written_bytes;
+    };
+
+    static AsyncLogger& Instance();
+
+    AsyncLogger(const AsyncLogger&) = delete;
+    AsyncLogger& operator=(const AsyncLogger&) = delete;
+
+    // appends to path, stderr if empty. The writer thread drains the rings
+    // every interval_ms or as soon as one is half full.
+    bool Start(const std::string& path = "",
+               LogOverflow overflow = LogOverflow::kDrop,
+               int interval_ms = 10);
+    // writes what is left, later records are written synchronously
+    void Stop();
+    // writes every record logged so far
+    void Flush();
+
+    bool IsRunning() const noexcept {
+        return m_running.load(std::memory_order_acquire);
+    }
+
+    void SetLevel(LogLevel level) noexcept {
+        m_level.store(static_cast<uint8_t>(level), std::memory_order_relaxed);
+    }
+    bool IsEnabled(LogLevel level) const noexcept {
+        return static_cast<uint8_t>(level) >=
+               m_level.load(std::memory_order_relaxed);
+    }
+
+    template <class... Args>
+    void Log(LogLevel level, const char* file, uint32_t line,
+             const char* format, const Args&... args) noexcept;
+
+    Stats GetStats() const noexcept;
+
+    // drains the rings from a signal handler and writes the stack. A drain
+    // stuck elsewhere is not waited for, only the stack is written then.
+    void CrashFlush(int signo) noexcept;
+
+private:
+    struct Ring {
+        std::atomic<uint64_t> m_head{0};  // writer thread
+        char m_padding[56];               // keeps m_head off the owner's line
+        std::atomic<uint64_t> m_tail{0};  // owning thread
+        uint64_t m_cached_head = 0;
+        // written by the owning thread only
+        std::atomic<uint64_t> m_logged{0};
+        std::atomic<uint64_t> m_dropped{0};
+        std::atomic<uint64_t> m_blocked{0};
+        char m_buffer[kRingBytes];
+    };
+
+    AsyncLogger();
+    ~AsyncLogger() {}
+
+    // single writer, so a load and a store instead of fetch_add
+    static void Increase(std::atomic<uint64_t>* counter) noexcept {
+        counter->store(counter->load(std::memory_order_relaxed) + 1,
+                       std::memory_order_relaxed);
+    }
+
+    Ring* CreateRing(uint32_t index) noexcept;
+    // room for size bytes, nullptr if the record is dropped
+    char* Reserve(Ring* ring, uint32_t size, uint64_t* next_tail) noexcept;
+    void Commit(Ring* ring, uint64_t next_tail) noexcept;
+    void WaitForRoom() noexcept;
+    void Fatal() noexcept __attribute__((noreturn));
+
+    // spins for the drain lock, false if max_spins passed first
+    bool LockDrain(uint64_t max_spins) noexcept;
+    void UnlockDrain() noexcept {
+        m_draining.store(false, std::memory_order_release);
+    }
+    // with the drain lock held
+    void DrainAll() noexcept;
+
+private:
+    std::atomic<uint8_t> m_level;
+    std::atomic<bool> m_running;
+    std::atomic<bool> m_draining;
+    LogOverflow m_overflow;
+    int m_fd;
+    bool m_owns_fd;
+    std::atomic<uint64_t> m_written_bytes;
+    // records of threads without a thread index, they have no ring
+    std::atomic<uint64_t> m_unindexed_dropped;
+    // wall clock at tick m_base_ticks, for time stamps
+    int64_t m_base_wall_ns;
+    uint64_t m_base_ticks;
+    std::atomic<Ring*> m_rings[kMaxThreadIndex];
+
+    std::mutex m_mutex;  // Start, Stop and the writer's sleep
+    std::condition_variable m_cond;
+    std::thread m_writer;
+};  // class AsyncLogger
+
+template <class... Args>
+void AsyncLogger::Log(LogLevel level, const char* file, uint32_t line,
+                      const char* format, const Args&... args) noexcept {
+    uint32_t index = ThisThreadIndex();
+    if (unlikely(index == kNoThreadIndex)) {
+        // a shared ring would have two writers, drop instead
+        m_unindexed_dropped.fetch_add(1, std::memory_order_relaxed);
+        if (unlikely(level == LogLevel::kFatal)) Fatal();
+        return;
+    }
+    Ring* ring = m_rings[index].load(std::memory_order_relaxed);
+    if (unlikely(ring == nullptr)) ring = CreateRing(index);
+
+    uint64_t size =
+        sizeof(detail::LogRecord) + detail::LogArgsSize(args...);
+    uint64_t next_tail = 0;
+    char* dst = size <= kRingBytes / 4
+                    ? Reserve(ring, static_cast<uint32_t>(size), &next_tail)
+                    : nullptr;
+    if (dst != nullptr) {
+        detail::LogRecord* record = reinterpret_cast<detail::LogRecord*>(dst);
+        record->m_size        = static_cast<uint32_t>((size + 7) & ~7ull);
+        record->m_tid         = detail::LogThreadId();
+        record->m_ticks       = TscClock::NowTicks();
+        record->m_file        = file;
+        record->m_format      = format;
+        record->m_format_func = &detail::FormatLogRecord<
+            typename std::decay<Args>::type...>;
+        record->m_line        = line;
+        record->m_level       = level;
+        detail::EncodeLogArgs(dst + sizeof(detail::LogRecord), args...);
+        Commit(ring, next_tail);
+    } else if (size > kRingBytes / 4) {
+        Increase(&ring->m_dropped);
+    }
+
+    if (unlikely(level == LogLevel::kFatal)) Fatal();
+    if (unlikely(!IsRunning())) Flush();
+}
+
+}  // namespace cbase
+
+// define CBASE_LOG_MIN_LEVEL to a LogLevel value to compile out every
+// record below it, e.g. -DCBASE_LOG_MIN_LEVEL=1 drops debug logs
+#ifndef CBASE_LOG_MIN_LEVEL
+#define CBASE_LOG_MIN_LEVEL 0
+#endif
+
+namespace cbase {
+namespace detail {
+
+constexpr bool LogLevelCompiledIn(LogLevel level) {
+    // + 1 keeps gcc from warning that level >= 0 always holds
+    return static_cast<int>(level) + 1 > CBASE_LOG_MIN_LEVEL;
+}
+
+}  // namespace detail
+}  // namespace cbase
+
+// CBASE_LOG(kInfo, "fmt", args...), the format is checked like printf
+#define CBASE_LOG(level, ...)                                              \
+    do {                                                                   \
+        if (cbase::detail::LogLevelCompiledIn(cbase::LogLevel::level) &&   \
+            cbase::AsyncLogger::Instance().IsEnabled(                      \
+                cbase::LogLevel::level)) {                                 \
+            if (false) cbase::detail::CheckLogFormat(__VA_ARGS__);         \
+            cbase::AsyncLogger::Instance().Log(cbase::LogLevel::level,     \
+                                               __FILE__, __LINE__,         \
+                                               __VA_ARGS__);               \
+        }                                                                  \
+    } while (0)
+
+#define CBASE_LOG_DEBUG(...) CBASE_LOG(kDebug, __VA_ARGS__)
+#define CBASE_LOG_INFO(...) CBASE_LOG(kInfo, __VA_ARGS__)
+#define CBASE_LOG_WARN(...) CBASE_LOG(kWarn, __VA_ARGS__)
+#define CBASE_LOG_ERROR(...) CBASE_LOG(kError, __VA_ARGS__)
+#define CBASE_LOG_FATAL(...) CBASE_LOG(kFatal, __VA_ARGS__)
@@ -3,11 +3,16 @@
 #include <array>
 #include <atomic>
 #include <memory>
+#include <thread>  // NOLINT
 #include <type_traits>
 #include <utility>
+#include "object_pool.h"
+#include "utils.h"
 
 namespace cbase {
 
+// Readers count in the low 16 bits, a writer holds 0x00010000. A taken
+// lock synchronizes with the previous unlock, so both CASs acquire.
 class rw_spin_lock {
 public:
     rw_spin_lock() : m_flag(0) {}
@@ -17,26 +22,50 @@ public:
     rw_spin_lock& operator=(const rw_spin_lock&) = delete;
 
     void shared_lock() {
-        uint32_t flag = 0;
-        do {
-            flag = m_flag.load(std::memory_order_acquire) & 0x0000FFFF;
-        } while (!m_flag.compare_exchange_weak(flag, flag + 1,
-                                               std::memory_order_release,
-                                               std::memory_order_relaxed));
+        uint32_t flag = m_flag.load(std::memory_order_relaxed);
+        for (uint32_t spins = 0;; ++spins) {
+            if (!(flag & kWriter) &&
+                m_flag.compare_exchange_weak(flag, flag + 1,
+                                             std::memory_order_acquire,
+                                             std::memory_order_relaxed)) {
+                return;
+            }
+            Pause(spins);
+            flag = m_flag.load(std::memory_order_relaxed);
+        }
     }
 
     void shared_unlock() { m_flag.fetch_sub(1, std::memory_order_release); }
 
     void lock() {
-        uint32_t flag = 0;
-        while (!m_flag.compare_exchange_weak(flag, 0x00010000,
-                                             std::memory_order_release,
+        for (uint32_t spins = 0;; ++spins) {
+            // only try the CAS once the line looks free, so waiters do
+            // not keep stealing it from the readers
+            uint32_t flag = 0;
+            if (m_flag.load(std::memory_order_relaxed) == 0 &&
+                m_flag.compare_exchange_weak(flag, kWriter,
+                                             std::memory_order_acquire,
                                              std::memory_order_relaxed)) {
-            flag = 0;
+                return;
+            }
+            Pause(spins);
         }
     }
     void unlock() { m_flag.store(0, std::memory_order_release); }
 
+private:
+    static constexpr uint32_t kWriter           = 0x00010000;
+    static constexpr uint32_t kSpinsBeforeYield = 1024;
+
+    // the holder may have been preempted, give it the core back
+    static void Pause(uint32_t spins) {
+        if (spins < kSpinsBeforeYield) {
+            cpu_relax();
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
 private:
     std::atomic<uint32_t> m_flag;
 };
@@ -98,8 +127,10 @@ public:
     void update(Args&&... args) {
         uint8_t read_index  = m_read_index.load(std::memory_order_acquire);
         uint8_t write_index = read_index ^ 1;
-        std::shared_ptr<T> handler(
-            std::make_shared<T>(std::forward<Args>(args)...));
+        // object and control block come from one pooled slot, it is
+        // usually released on a reader thread
+        std::shared_ptr<T> handler(std::allocate_shared<T>(
+            pool_allocator<T>(), std::forward<Args>(args)...));
 
         scoped_exclusive_guard<rw_spin_lock> lock(m_spin_locks[write_index]);
         m_buffering_handlers[write_index] = std::move(handler);
@@ -0,0 +1,279 @@
+// Contention benchmark and stress test for buffering_ptr and rw_spin_lock.
+//   buffering_ptr_bench [millis_per_case] [max_threads]
+//     sweeps threads, read:write ratios and payload sizes, reports get()
+//     and update() throughput and latency percentiles
+//   buffering_ptr_bench stress [seconds] [max_threads]
+//     randomized rounds checking that readers never see a torn, stale or
+//     destroyed object, exits 1 on the first violation
+// g++ -std=c++11 -O2 buffering_ptr_bench.cpp latency_histogram.cpp
+//     thread_index.cpp tsc_clock.cpp -lpthread
+#include <algorithm>
+#include <atomic>
+#include <chrono>  // NOLINT
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>  // NOLINT
+#include <vector>
+#include "buffering_ptr.h"
+#include "chrono_time_elapser.h"
+#include "latency_histogram.h"
+#include "tsc_clock.h"
+
+static std::atomic<int64_t> g_live(0);
+static std::atomic<uint64_t> g_violations(0);
+
+template <size_t N>
+struct Payload {
+    static constexpr uint64_t kAlive = 0x5afe5afe5afe5afeull;
+    static constexpr uint64_t kDead  = 0xdeaddeaddeaddeadull;
+
+    Payload() : Payload(0) {}
+    explicit Payload(uint64_t seq) : m_head(kAlive), m_seq(seq) {
+        memset(m_bytes, static_cast<int>(seq & 0xff), N);
+        m_tail = kAlive;
+        g_live.fetch_add(1, std::memory_order_relaxed);
+    }
+    ~Payload() {
+        // volatile, the stores to a dying object would be dropped otherwise
+        *static_cast<volatile uint64_t*>(&m_head) = kDead;
+        *static_cast<volatile uint64_t*>(&m_tail) = kDead;
+        g_live.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    bool Intact() const noexcept {
+        if (m_head != kAlive || m_tail != kAlive) return false;
+        char fill = static_cast<char>(m_seq & 0xff);
+        for (size_t i = 0; i < N; ++i) {
+            if (m_bytes[i] != fill) return false;
+        }
+        return true;
+    }
+
+    uint64_t m_head;
+    uint64_t m_seq;
+    char m_bytes[N];
+    uint64_t m_tail;
+};
+
+template <size_t N>
+constexpr uint64_t Payload<N>::kAlive;
+template <size_t N>
+constexpr uint64_t Payload<N>::kDead;
+
+static uint64_t XorShift(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static void Violation(const char* what, uint64_t seq) {
+    if (g_violations.fetch_add(1) < 8) {
+        fprintf(stderr, "violation: %s (seq %llu)\n", what,
+                static_cast<unsigned long long>(seq));  // NOLINT
+    }
+}
+
+struct ThreadResult {
+    cbase::Histogram m_get;
+    cbase::Histogram m_update;
+    uint64_t m_sink = 0;
+};
+
+template <size_t N>
+static void RunCase(int threads, int write_per_mille, int millis) {
+    cbase::buffering_ptr<Payload<N>> ptr;
+    std::atomic<uint64_t> next_seq(1);
+    std::atomic<bool> stop(false);
+    std::vector<ThreadResult> results(threads);
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            ThreadResult& result = results[t];
+            uint64_t rng = 0x9e3779b97f4a7c15ull * (t + 1);
+            while (!stop.load(std::memory_order_relaxed)) {
+                bool write =
+                    static_cast<int>(XorShift(&rng) % 1000) < write_per_mille;
+                uint64_t start = cbase::TscClock::NowTicks();
+                if (write) {
+                    ptr.update(next_seq.fetch_add(1));
+                } else {
+                    std::shared_ptr<Payload<N>> obj = ptr.get();
+                    result.m_sink += obj->m_bytes[0] + obj->m_bytes[N - 1];
+                }
+                uint64_t nanos = cbase::TscClock::TicksToNanos(
+                    cbase::TscClock::NowTicks() - start);
+                (write ? result.m_update : result.m_get).Record(nanos);
+            }
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(millis));
+    stop.store(true);
+    for (auto& worker : workers) worker.join();
+
+    cbase::Histogram get;
+    cbase::Histogram update;
+    uint64_t sink = 0;
+    for (const auto& result : results) {
+        get.Merge(result.m_get);
+        update.Merge(result.m_update);
+        sink += result.m_sink;
+    }
+    double seconds = millis / 1000.0;
+    printf("%3d %5d:%-4d %6zu | get %8.2f Mops p50 %6llu p99 %7llu "
+           "p99.9 %8llu | update %7.3f Mops p50 %7llu p99 %8llu  (%llu)\n",
+           threads, 1000 - write_per_mille, write_per_mille, N,
+           get.Count() / seconds / 1e6,
+           static_cast<unsigned long long>(get.Percentile(50)),    // NOLINT
+           static_cast<unsigned long long>(get.Percentile(99)),    // NOLINT
+           static_cast<unsigned long long>(get.Percentile(99.9)),  // NOLINT
+           update.Count() / seconds / 1e6,
+           static_cast<unsigned long long>(update.Percentile(50)),  // NOLINT
+           static_cast<unsigned long long>(update.Percentile(99)),  // NOLINT
+           static_cast<unsigned long long>(sink & 0xff));           // NOLINT
+}
+
+static std::vector<int> ThreadCounts(int max_threads) {
+    std::vector<int> counts;
+    for (int t = 1; t < max_threads; t *= 2) counts.push_back(t);
+    counts.push_back(max_threads);
+    return counts;
+}
+
+static void Bench(int millis, int max_threads) {
+    printf("thr  read:write  bytes | latencies in ns\n");
+    for (int threads : ThreadCounts(max_threads)) {
+        for (int write_per_mille : {0, 1, 10, 100, 500}) {
+            RunCase<16>(threads, write_per_mille, millis);
+            RunCase<256>(threads, write_per_mille, millis);
+            RunCase<4096>(threads, write_per_mille, millis);
+        }
+    }
+}
+
+// One round: writers publish increasing seqs, readers check every object
+// they get and keep a few of them alive across updates to check them again
+// later. With a single writer a reader must never go back in seq.
+template <size_t N>
+static void StressRound(int readers, int writers, int millis, uint64_t seed) {
+    {
+        cbase::buffering_ptr<Payload<N>> ptr;
+        std::atomic<uint64_t> next_seq(1);
+        std::atomic<bool> stop(false);
+        std::vector<std::thread> threads;
+
+        for (int w = 0; w < writers; ++w) {
+            threads.emplace_back([&, w] {
+                uint64_t rng = seed + w * 7919 + 1;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    ptr.update(next_seq.fetch_add(1));
+                    if (XorShift(&rng) % 4 == 0) std::this_thread::yield();
+                }
+            });
+        }
+        for (int r = 0; r < readers; ++r) {
+            threads.emplace_back([&, r] {
+                uint64_t rng = seed + r * 104729 + 3;
+                std::shared_ptr<Payload<N>> kept[4];
+                uint64_t last_seq = 0;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    std::shared_ptr<Payload<N>> obj = ptr.get();
+                    if (!obj->Intact()) Violation("torn object", obj->m_seq);
+                    if (writers == 1 && obj->m_seq < last_seq) {
+                        Violation("seq went back", obj->m_seq);
+                    }
+                    last_seq = std::max(last_seq, obj->m_seq);
+
+                    uint64_t dice = XorShift(&rng);
+                    std::shared_ptr<Payload<N>>& slot = kept[dice % 4];
+                    if (slot && !slot->Intact()) {
+                        Violation("kept object destroyed", slot->m_seq);
+                    }
+                    if (dice & 0x100) slot = std::move(obj);
+                    if ((dice & 0xf000) == 0) std::this_thread::yield();
+                }
+            });
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(millis));
+        stop.store(true);
+        for (auto& thread : threads) thread.join();
+    }
+    if (g_live.load() != 0) Violation("objects leaked", g_live.load());
+}
+
+// writers keep the two halves equal under the exclusive lock, a reader that
+// sees them differ got in without synchronizing with the last unlock
+static void StressLock(int readers, int writers, int millis) {
+    cbase::rw_spin_lock lock;
+    uint64_t halves[2] = {0, 0};
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> threads;
+
+    for (int w = 0; w < writers; ++w) {
+        threads.emplace_back([&] {
+            while (!stop.load(std::memory_order_relaxed)) {
+                cbase::scoped_exclusive_guard<cbase::rw_spin_lock> guard(lock);
+                ++halves[0];
+                ++halves[1];
+            }
+        });
+    }
+    for (int r = 0; r < readers; ++r) {
+        threads.emplace_back([&] {
+            while (!stop.load(std::memory_order_relaxed)) {
+                cbase::scoped_share_guard<cbase::rw_spin_lock> guard(lock);
+                if (halves[0] != halves[1]) {
+                    Violation("rw_spin_lock halves differ", halves[0]);
+                }
+            }
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(millis));
+    stop.store(true);
+    for (auto& thread : threads) thread.join();
+}
+
+static int Stress(int seconds, int max_threads) {
+    uint64_t rng = static_cast<uint64_t>(cbase::TscClock::SteadyNanos()) | 1;
+    int threads_cap = std::max(4, max_threads * 2);
+    cbase::ChronoTimeElapser elapser;
+    uint64_t rounds = 0;
+    while (elapser.ElapsedTime() < static_cast<uint64_t>(seconds) * 1000000 &&
+           g_violations.load() == 0) {
+        uint64_t dice    = XorShift(&rng);
+        int writers      = 1 + static_cast<int>(dice % 3 == 0 ? dice % 4 : 0);
+        int readers      = 1 + static_cast<int>((dice >> 8) % threads_cap);
+        int millis       = 20 + static_cast<int>((dice >> 16) % 180);
+        switch ((dice >> 24) % 4) {
+        case 0: StressRound<8>(readers, writers, millis, dice); break;
+        case 1: StressRound<256>(readers, writers, millis, dice); break;
+        case 2: StressRound<4096>(readers, writers, millis, dice); break;
+        default: StressLock(readers, writers, millis); break;
+        }
+        ++rounds;
+    }
+    printf("stress: %llu rounds, %llu violations\n",
+           static_cast<unsigned long long>(rounds),          // NOLINT
+           static_cast<unsigned long long>(g_violations));   // NOLINT
+    return g_violations.load() == 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+    int cores = static_cast<int>(std::thread::hardware_concurrency());
+    if (cores <= 0) cores = 1;
+
+    if (argc > 1 && strcmp(argv[1], "stress") == 0) {
+        int seconds     = argc > 2 ? atoi(argv[2]) : 60;
+        int max_threads = argc > 3 ? atoi(argv[3]) : cores;
+        return Stress(seconds, max_threads);
+    }
+    int millis      = argc > 1 ? atoi(argv[1]) : 200;
+    int max_threads = argc > 2 ? atoi(argv[2]) : cores;
+    Bench(millis, max_threads);
+    return 0;
+}
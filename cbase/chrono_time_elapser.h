@@ -20,6 +20,12 @@ public:
             .count();
     }
 
+    uint64_t ElapsedNanos() const noexcept {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   Clock::now() - m_t_start)
+            .count();
+    }
+
 private:
     using Clock = std::chrono::steady_clock;
     const Clock::time_point m_t_start;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <chrono>              // NOLINT
 #include <condition_variable>  // NOLINT
 #include <mutex>               // NOLINT
 #include <queue>
@@ -16,20 +17,38 @@ public:
     concurrent_queue(const concurrent_queue&) = delete;
     concurrent_queue& operator=(const concurrent_queue&) = delete;
 
-    void push(const Data& data) {
-        {
-            std::lock_guard<std::mutex> lock(m_mutex);
-            m_queue.push(data);
-        }
-        m_condition_variable.notify_one();
-    }
+    // a consumer that parks itself instead of blocking a thread, see co_pop
+    // in coroutine.h. push() moves the data into m_slot and calls m_wake
+    // outside the lock.
+    struct waiter {
+        Data* m_slot            = nullptr;
+        void (*m_wake)(waiter*) = nullptr;
+        void* m_ctx             = nullptr;
+        waiter* m_next          = nullptr;
+    };
 
-    void push(Data&& data) {
-        {
-            std::lock_guard<std::mutex> lock(m_mutex);
-            m_queue.push(std::move(data));
+    void push(const Data& data) { push_impl(Data(data)); }
+
+    void push(Data&& data) { push_impl(std::move(data)); }
+
+    // pops into data if not empty, otherwise parks w (if given) until the
+    // next push and returns false
+    bool pop_or_park(Data& data, waiter* w) {  // NOLINT
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_queue.empty()) {
+            data = std::move(m_queue.front());
+            m_queue.pop();
+            return true;
+        }
+        if (w == nullptr) return false;
+        w->m_next = nullptr;
+        if (m_waiter_tail == nullptr) {
+            m_waiter_head = w;
+        } else {
+            m_waiter_tail->m_next = w;
         }
-        m_condition_variable.notify_one();
+        m_waiter_tail = w;
+        return false;
     }
 
     void pop(Data& data) {  // NOLINT
@@ -65,9 +84,33 @@ public:
         return m_queue.size();
     }
 
+protected:
+    // parked waiters are served first, in FIFO order
+    void push_impl(Data&& data) {
+        waiter* w = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_waiter_head != nullptr) {
+                w             = m_waiter_head;
+                m_waiter_head = w->m_next;
+                if (m_waiter_head == nullptr) m_waiter_tail = nullptr;
+                *w->m_slot = std::move(data);
+            } else {
+                m_queue.push(std::move(data));
+            }
+        }
+        if (w != nullptr) {
+            w->m_wake(w);
+        } else {
+            m_condition_variable.notify_one();
+        }
+    }
+
 protected:
     mutable std::mutex m_mutex;
     mutable std::condition_variable m_condition_variable;
     std::queue<Data> m_queue;
+    waiter* m_waiter_head = nullptr;
+    waiter* m_waiter_tail = nullptr;
 };
 }  // namespace cbase
@@ -0,0 +1,141 @@
+#include "coroutine.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cassert>
+#include <cerrno>
+
+namespace cbase {
+
+namespace {
+thread_local Scheduler* t_current = nullptr;
+}  // namespace
+
+Scheduler::Scheduler()
+    : m_epoll_fd(epoll_create1(EPOLL_CLOEXEC)),
+      m_event_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+      m_stop(false),
+      m_running(false) {
+    assert(m_epoll_fd >= 0 && "epoll_create1 failed.");
+    assert(m_event_fd >= 0 && "eventfd failed.");
+    struct epoll_event event;
+    event.events   = EPOLLIN;
+    event.data.ptr = nullptr;  // the only registration without awaiter
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_event_fd, &event);
+}
+
+Scheduler::~Scheduler() {
+    assert(!m_running.load() && "destroy a running scheduler.");
+    close(m_event_fd);
+    close(m_epoll_fd);
+}
+
+Scheduler* Scheduler::Current() noexcept { return t_current; }
+
+void Scheduler::Schedule(std::coroutine_handle<> handle) {
+    if (t_current == this) {
+        m_ready.push_back(handle);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_remote.push_back(handle);
+    }
+    uint64_t one = 1;
+    ssize_t ret  = write(m_event_fd, &one, sizeof(one));
+    (void)ret;  // EAGAIN means a wakeup is pending anyway
+}
+
+void Scheduler::Stop() {
+    m_stop.store(true, std::memory_order_release);
+    uint64_t one = 1;
+    ssize_t ret  = write(m_event_fd, &one, sizeof(one));
+    (void)ret;
+}
+
+void Scheduler::Run() {
+    assert(t_current == nullptr && "nested Scheduler::Run.");
+    t_current = this;
+    m_running.store(true);
+    DrainRemote();
+    while (!m_stop.load(std::memory_order_acquire)) {
+        // only what is ready now, so that fds get polled between rounds
+        for (size_t cnt = m_ready.size(); cnt > 0 && !m_ready.empty(); --cnt) {
+            std::coroutine_handle<> handle = m_ready.front();
+            m_ready.pop_front();
+            handle.resume();
+        }
+        if (m_stop.load(std::memory_order_acquire)) break;
+
+        int timeout_ms = -1;
+        if (!m_ready.empty()) {
+            timeout_ms = 0;
+        } else if (!m_polling.empty()) {
+            timeout_ms = kPollIntervalMs;
+        }
+        Wait(timeout_ms);
+        for (auto handle : m_polling) m_ready.push_back(handle);
+        m_polling.clear();
+    }
+    m_stop.store(false);
+    m_running.store(false);
+    t_current = nullptr;
+}
+
+void Scheduler::Wait(int timeout_ms) {
+    struct epoll_event events[kMaxEvents];
+    int cnt = epoll_wait(m_epoll_fd, events, kMaxEvents, timeout_ms);
+    if (cnt < 0 && errno != EINTR) return;
+    for (int i = 0; i < cnt; ++i) {
+        auto* awaiter = static_cast<FdAwaiter*>(events[i].data.ptr);
+        if (awaiter == nullptr) {
+            uint64_t value = 0;
+            ssize_t ret    = read(m_event_fd, &value, sizeof(value));
+            (void)ret;
+            DrainRemote();
+            continue;
+        }
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, awaiter->m_fd, nullptr);
+        awaiter->m_revents = events[i].events;
+        m_ready.push_back(awaiter->m_handle);
+    }
+}
+
+void Scheduler::DrainRemote() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto handle : m_remote) m_ready.push_back(handle);
+    m_remote.clear();
+}
+
+bool Scheduler::WatchFd(FdAwaiter* awaiter) noexcept {
+    struct epoll_event event;
+    event.events   = awaiter->m_events;
+    event.data.ptr = awaiter;
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, awaiter->m_fd, &event) != 0) {
+        awaiter->m_revents = EPOLLERR;
+        return false;  // resume right away
+    }
+    return true;
+}
+
+int FileEventStream::WatchDir(const std::string& dir, uint32_t mask) {
+    auto on_event = [this](const std::string& dir_name,
+                           const std::string& file_name,
+                           action::FileAction file_action) {
+        m_events.push_back(FileEvent{dir_name, file_name, file_action});
+        return 0;
+    };
+    return m_watcher->WatchDir(dir, on_event, mask);
+}
+
+co_task<FileEvent> FileEventStream::Next() {
+    while (m_events.empty()) {
+        co_await Scheduler::Current()->Readable(m_watcher->Fd());
+        m_watcher->HandleEvents();
+    }
+    FileEvent event = std::move(m_events.front());
+    m_events.pop_front();
+    co_return event;
+}
+
+}  // namespace cbase
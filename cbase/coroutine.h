@@ -0,0 +1,341 @@
+#pragma once
+
+// C++20 coroutine support, build with -std=c++20.
+//
+//   cbase::Scheduler scheduler;
+//   scheduler.Spawn(Consume(&queue));   // co_task<void> Consume(...)
+//   scheduler.Run();
+//
+// A Scheduler resumes coroutines on the thread that calls Run(): an epoll
+// loop for fd readiness plus a ready queue that any thread may post to.
+// Several schedulers on a few threads can host thousands of consumers.
+
+#include <sys/epoll.h>
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>  // NOLINT
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "concurrent_queue.h"
+#include "file_watcher.h"
+#include "lockfree_queue.h"
+
+namespace cbase {
+
+template <class T = void>
+class co_task;
+
+namespace detail {
+
+struct co_promise_base {
+    std::coroutine_handle<> m_continuation;
+    std::exception_ptr m_exception;
+    bool m_detached = false;
+
+    struct final_awaiter {
+        bool await_ready() const noexcept { return false; }
+
+        template <class Promise>
+        std::coroutine_handle<> await_suspend(
+            std::coroutine_handle<Promise> handle) noexcept {
+            co_promise_base& promise = handle.promise();
+            if (promise.m_detached) {
+                // nobody could observe it, same as an escaping std::thread
+                if (promise.m_exception) std::terminate();
+                handle.destroy();
+                return std::noop_coroutine();
+            }
+            if (promise.m_continuation) return promise.m_continuation;
+            return std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    final_awaiter final_suspend() const noexcept { return {}; }
+    void unhandled_exception() noexcept {
+        m_exception = std::current_exception();
+    }
+};
+
+template <class T>
+struct co_promise : co_promise_base {
+    std::optional<T> m_value;
+
+    template <class U>
+    void return_value(U&& value) {
+        m_value.emplace(std::forward<U>(value));
+    }
+};
+
+template <>
+struct co_promise<void> : co_promise_base {
+    void return_void() const noexcept {}
+};
+
+}  // namespace detail
+
+// Lazy coroutine, the body starts when the task is awaited or spawned on
+// a Scheduler. Awaiting resumes the caller when the body finishes and
+// hands back its result or exception.
+template <class T>
+class co_task {
+public:
+    struct promise_type : detail::co_promise<T> {
+        co_task get_return_object() noexcept {
+            return co_task(
+                std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+    };
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    co_task() noexcept = default;
+    co_task(co_task&& other) noexcept
+        : m_handle(std::exchange(other.m_handle, nullptr)) {}
+    co_task& operator=(co_task&& other) noexcept {
+        if (this != &other) {
+            if (m_handle) m_handle.destroy();
+            m_handle = std::exchange(other.m_handle, nullptr);
+        }
+        return *this;
+    }
+    ~co_task() {
+        if (m_handle) m_handle.destroy();
+    }
+
+    co_task(const co_task&) = delete;
+    co_task& operator=(const co_task&) = delete;
+
+    bool await_ready() const noexcept { return !m_handle || m_handle.done(); }
+
+    std::coroutine_handle<> await_suspend(
+        std::coroutine_handle<> caller) noexcept {
+        m_handle.promise().m_continuation = caller;
+        return m_handle;
+    }
+
+    T await_resume() {
+        auto& promise = m_handle.promise();
+        if (promise.m_exception) std::rethrow_exception(promise.m_exception);
+        if constexpr (!std::is_void_v<T>) return std::move(*promise.m_value);
+    }
+
+    // the frame destroys itself at the end, used by Scheduler::Spawn
+    handle_type Detach() noexcept {
+        m_handle.promise().m_detached = true;
+        return std::exchange(m_handle, nullptr);
+    }
+
+private:
+    explicit co_task(handle_type handle) noexcept : m_handle(handle) {}
+
+    handle_type m_handle;
+};
+
+class Scheduler {
+public:
+    Scheduler();
+    // coroutines still suspended are leaked, they may be parked on queues
+    ~Scheduler();
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    // scheduler of the calling thread while it is inside Run()
+    static Scheduler* Current() noexcept;
+
+    // starts task on this scheduler, thread safe
+    void Spawn(co_task<void> task) { Schedule(task.Detach()); }
+
+    // resumes handle on the thread running Run(), thread safe
+    void Schedule(std::coroutine_handle<> handle);
+
+    // resumes coroutines until Stop()
+    void Run();
+    // thread safe, Run() returns after the coroutine running now suspends
+    void Stop();
+
+    // co_await yields the epoll events of fd, EPOLLERR if fd cannot be
+    // watched. One waiter per fd at a time.
+    class FdAwaiter {
+    public:
+        FdAwaiter(Scheduler* scheduler, int fd, uint32_t events) noexcept
+            : m_scheduler(scheduler), m_fd(fd), m_events(events) {}
+
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> handle) noexcept {
+            m_handle = handle;
+            return m_scheduler->WatchFd(this);
+        }
+        uint32_t await_resume() const noexcept { return m_revents; }
+
+    private:
+        friend class Scheduler;
+
+        Scheduler* m_scheduler;
+        int m_fd;
+        uint32_t m_events;
+        uint32_t m_revents = 0;
+        std::coroutine_handle<> m_handle;
+    };
+
+    FdAwaiter Readable(int fd) noexcept { return FdAwaiter(this, fd, EPOLLIN); }
+    FdAwaiter Writable(int fd) noexcept {
+        return FdAwaiter(this, fd, EPOLLOUT);
+    }
+
+    // resumes the caller after the other ready coroutines
+    struct YieldAwaiter {
+        Scheduler* m_scheduler;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) {
+            m_scheduler->m_ready.push_back(handle);
+        }
+        void await_resume() const noexcept {}
+    };
+    YieldAwaiter Yield() noexcept { return YieldAwaiter{this}; }
+
+    // like Yield, but when only pollers are left the loop sleeps up to
+    // kPollIntervalMs, for sources that cannot notify such as
+    // lockfree_queue
+    struct PollAwaiter {
+        Scheduler* m_scheduler;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) {
+            m_scheduler->m_polling.push_back(handle);
+        }
+        void await_resume() const noexcept {}
+    };
+    PollAwaiter Poll() noexcept { return PollAwaiter{this}; }
+
+private:
+    static constexpr int kPollIntervalMs = 1;
+    static constexpr int kMaxEvents      = 64;
+
+    bool WatchFd(FdAwaiter* awaiter) noexcept;
+    void DrainRemote();
+    void Wait(int timeout_ms);
+
+private:
+    int m_epoll_fd;
+    int m_event_fd;  // wakes epoll_wait for Schedule and Stop
+    std::atomic<bool> m_stop;
+    std::atomic<bool> m_running;
+
+    std::deque<std::coroutine_handle<>> m_ready;    // Run() thread only
+    std::vector<std::coroutine_handle<>> m_polling;  // Run() thread only
+
+    std::mutex m_mutex;
+    std::vector<std::coroutine_handle<>> m_remote;
+};  // class Scheduler
+
+// co_await co_pop(queue) suspends until push() hands data over, the
+// coroutine is then resumed on the scheduler it was parked on
+template <class Data>
+class concurrent_queue_pop_awaiter {
+public:
+    explicit concurrent_queue_pop_awaiter(concurrent_queue<Data>* queue)
+        : m_queue(queue) {}
+
+    bool await_ready() { return m_queue->pop_or_park(m_data, nullptr); }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+        m_handle          = handle;
+        m_scheduler       = Scheduler::Current();
+        m_waiter.m_slot   = &m_data;
+        m_waiter.m_wake   = &Wake;
+        m_waiter.m_ctx    = this;
+        return !m_queue->pop_or_park(m_data, &m_waiter);
+    }
+
+    Data await_resume() { return std::move(m_data); }
+
+private:
+    static void Wake(typename concurrent_queue<Data>::waiter* waiter) {
+        auto* self = static_cast<concurrent_queue_pop_awaiter*>(waiter->m_ctx);
+        self->m_scheduler->Schedule(self->m_handle);
+    }
+
+    concurrent_queue<Data>* m_queue;
+    Data m_data;
+    typename concurrent_queue<Data>::waiter m_waiter;
+    Scheduler* m_scheduler = nullptr;
+    std::coroutine_handle<> m_handle;
+};
+
+template <class Data>
+concurrent_queue_pop_awaiter<Data> co_pop(concurrent_queue<Data>& queue) {
+    return concurrent_queue_pop_awaiter<Data>(&queue);
+}
+
+// concurrent_queue is unbounded, so pushing never suspends
+template <class Data>
+struct concurrent_queue_push_awaiter {
+    concurrent_queue<Data>* m_queue;
+    Data m_data;
+
+    bool await_ready() const noexcept { return true; }
+    void await_suspend(std::coroutine_handle<>) const noexcept {}
+    void await_resume() { m_queue->push(std::move(m_data)); }
+};
+
+template <class Data>
+concurrent_queue_push_awaiter<Data> co_push(concurrent_queue<Data>& queue,
+                                            Data data) {
+    return concurrent_queue_push_awaiter<Data>{&queue, std::move(data)};
+}
+
+// lockfree_queue has no way to notify, the coroutine retries once per
+// scheduler round
+template <class Data, std::size_t N, class Wait>
+co_task<Data> co_pop(lockfree_queue<Data, N, Wait>& queue) {
+    Data data;
+    while (queue.pop(data) != 0) co_await Scheduler::Current()->Poll();
+    co_return data;
+}
+
+template <class Data, std::size_t N, class Wait>
+co_task<void> co_push(lockfree_queue<Data, N, Wait>& queue, Data data) {
+    while (queue.push(data) != 0) co_await Scheduler::Current()->Poll();
+}
+
+struct FileEvent {
+    std::string m_dir;
+    std::string m_name;
+    action::FileAction m_action;
+};
+
+// Turns the callbacks of a FileWatcher into a stream of events:
+//
+//   while (true) {
+//       cbase::FileEvent event = co_await stream.Next();
+//   }
+//
+// Other watches of the same FileWatcher keep their own callbacks, which
+// run on the scheduler thread. One consumer per stream.
+class FileEventStream {
+public:
+    explicit FileEventStream(FileWatcher* watcher) : m_watcher(watcher) {}
+
+    FileEventStream(const FileEventStream&) = delete;
+    FileEventStream& operator=(const FileEventStream&) = delete;
+
+    // same as FileWatcher::WatchDir
+    int WatchDir(const std::string& dir, uint32_t mask);
+
+    co_task<FileEvent> Next();
+
+private:
+    FileWatcher* m_watcher;
+    std::deque<FileEvent> m_events;
+};
+
+}  // namespace cbase
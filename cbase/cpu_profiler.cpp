@@ -0,0 +1,295 @@
+#include "cpu_profiler.h"
+
+#include <errno.h>
+#include <sys/syscall.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>  // NOLINT
+#include <cstdio>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include "stack_trace.h"
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+namespace cbase {
+
+namespace {
+
+// read from the signal handler, so it has to be initial-exec tls
+static __thread void* t_slot __attribute__((tls_model("initial-exec"))) =
+    nullptr;
+
+struct ThreadExitHook {
+    bool m_registered = false;
+    ~ThreadExitHook() {
+        if (m_registered) CpuProfiler::Instance().UnregisterThread();
+    }
+};
+static thread_local ThreadExitHook t_exit_hook;
+
+// pc of the interrupted instruction, frames above it belong to the handler
+static void* InterruptedPc(void* context) {
+    const ucontext_t* uc = static_cast<const ucontext_t*>(context);
+#if defined(__x86_64__)
+    return reinterpret_cast<void*>(uc->uc_mcontext.gregs[REG_RIP]);
+#elif defined(__aarch64__)
+    return reinterpret_cast<void*>(uc->uc_mcontext.pc);
+#else
+    return nullptr;
+#endif
+}
+
+constexpr int kAggregateIntervalMs = 100;
+
+}  // namespace
+
+CpuProfiler& CpuProfiler::Instance() {
+    static CpuProfiler* profiler = new CpuProfiler();  // never destroyed
+    return *profiler;
+}
+
+CpuProfiler::CpuProfiler()
+    : m_running(false), m_dropped(0), m_frequency_hz(0), m_slots{} {
+    struct sigaction action = {};
+    action.sa_sigaction     = &CpuProfiler::SignalHandler;
+    action.sa_flags         = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, nullptr);
+}
+
+bool CpuProfiler::Start(int frequency_hz) {
+    if (frequency_hz <= 0 || frequency_hz > 1000000) return false;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (IsRunning()) return false;
+
+    m_frequency_hz = frequency_hz;
+    m_running.store(true, std::memory_order_release);
+    for (ThreadSlot* slot : m_slots) {
+        if (slot != nullptr) ArmTimer(slot, m_frequency_hz);
+    }
+    m_aggregator = std::thread([this] {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (IsRunning()) {
+            m_cond.wait_for(lock,
+                            std::chrono::milliseconds(kAggregateIntervalMs));
+            for (ThreadSlot* slot : m_slots) {
+                if (slot != nullptr) Drain(slot);
+            }
+        }
+    });
+    return true;
+}
+
+void CpuProfiler::Stop() {
+    std::thread aggregator;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!IsRunning()) return;
+        m_running.store(false, std::memory_order_release);
+        for (ThreadSlot* slot : m_slots) {
+            if (slot != nullptr) ArmTimer(slot, 0);
+        }
+        aggregator.swap(m_aggregator);
+    }
+    m_cond.notify_all();
+    aggregator.join();
+    Aggregate();
+}
+
+bool CpuProfiler::RegisterThread() {
+    if (t_slot != nullptr) return true;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int idx = 0;
+    while (idx < kMaxThreads && m_slots[idx] != nullptr) ++idx;
+    if (idx == kMaxThreads) return false;
+
+    ThreadSlot* slot = new ThreadSlot();
+    slot->m_tid      = static_cast<pid_t>(syscall(SYS_gettid));
+
+    struct sigevent event       = {};
+    event.sigev_notify          = SIGEV_THREAD_ID;
+    event.sigev_signo           = SIGPROF;
+    event.sigev_notify_thread_id = slot->m_tid;
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &slot->m_timer) != 0) {
+        delete slot;
+        return false;
+    }
+
+    m_slots[idx]             = slot;
+    t_slot                   = slot;
+    t_exit_hook.m_registered = true;
+    if (IsRunning()) ArmTimer(slot, m_frequency_hz);
+    return true;
+}
+
+void CpuProfiler::UnregisterThread() {
+    ThreadSlot* slot = static_cast<ThreadSlot*>(t_slot);
+    if (slot == nullptr) return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    timer_delete(slot->m_timer);
+    t_slot = nullptr;
+    Drain(slot);
+    for (ThreadSlot*& s : m_slots) {
+        if (s == slot) s = nullptr;
+    }
+    t_exit_hook.m_registered = false;
+    delete slot;
+}
+
+bool CpuProfiler::ArmTimer(ThreadSlot* slot, int frequency_hz) {
+    struct itimerspec spec = {};
+    if (frequency_hz > 0) {
+        long interval_ns         = 1000000000L / frequency_hz;  // NOLINT
+        spec.it_interval.tv_sec  = interval_ns / 1000000000L;
+        spec.it_interval.tv_nsec = interval_ns % 1000000000L;
+        spec.it_value            = spec.it_interval;
+    }
+    return timer_settime(slot->m_timer, 0, &spec, nullptr) == 0;
+}
+
+void CpuProfiler::SignalHandler(int /*signo*/, siginfo_t* /*info*/,
+                                void* context) {
+    ThreadSlot* slot = static_cast<ThreadSlot*>(t_slot);
+    if (slot == nullptr || !Instance().IsRunning()) return;
+
+    int saved_errno = errno;
+    Record(slot, InterruptedPc(context));
+    errno = saved_errno;
+}
+
+void CpuProfiler::Record(ThreadSlot* slot, void* pc) {
+    uint64_t tail = slot->m_tail.load(std::memory_order_relaxed);
+    uint64_t head = slot->m_head.load(std::memory_order_acquire);
+    if (tail - head >= static_cast<uint64_t>(kRingSize)) {
+        Instance().m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    Sample& sample = slot->m_samples[tail % kRingSize];
+    int depth      = CaptureStack(sample.m_frames, kMaxDepth);
+    int begin      = 0;
+    while (begin < depth && sample.m_frames[begin] != pc) ++begin;
+    if (begin == depth) begin = 0;
+    for (int i = begin; i < depth; ++i) {
+        sample.m_frames[i - begin] = sample.m_frames[i];
+    }
+    sample.m_depth = depth - begin;
+    slot->m_tail.store(tail + 1, std::memory_order_release);
+}
+
+void CpuProfiler::Aggregate() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (ThreadSlot* slot : m_slots) {
+        if (slot != nullptr) Drain(slot);
+    }
+}
+
+void CpuProfiler::Drain(ThreadSlot* slot) {
+    uint64_t head = slot->m_head.load(std::memory_order_relaxed);
+    uint64_t tail = slot->m_tail.load(std::memory_order_acquire);
+    for (; head < tail; ++head) {
+        const Sample& sample = slot->m_samples[head % kRingSize];
+        if (sample.m_depth <= 0) continue;
+        std::vector<void*> stack(sample.m_frames,
+                                 sample.m_frames + sample.m_depth);
+        ++m_stacks[std::move(stack)];
+    }
+    slot->m_head.store(tail, std::memory_order_release);
+}
+
+std::string CpuProfiler::FoldedStacks() {
+    Aggregate();
+
+    std::map<std::string, uint64_t> folded;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto& it : m_stacks) {
+            const std::vector<void*>& frames = it.first;
+            std::string line;
+            for (auto frame = frames.rbegin(); frame != frames.rend();
+                 ++frame) {
+                if (!line.empty()) line.push_back(';');
+                line.append(FunctionName(*frame));
+            }
+            folded[line] += it.second;
+        }
+    }
+
+    std::string result;
+    for (const auto& it : folded) {
+        result.append(it.first)
+            .append(" ")
+            .append(std::to_string(it.second))
+            .append("\n");
+    }
+    return result;
+}
+
+std::string CpuProfiler::TopFunctions(size_t n) {
+    Aggregate();
+
+    uint64_t sample_cnt = 0;
+    std::unordered_map<std::string, std::pair<uint64_t, uint64_t>> funcs;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto& it : m_stacks) {
+            sample_cnt += it.second;
+            std::set<std::string> seen;
+            for (size_t i = 0; i < it.first.size(); ++i) {
+                std::string name = FunctionName(it.first[i]);
+                if (i == 0) funcs[name].first += it.second;
+                if (seen.insert(name).second) funcs[name].second += it.second;
+            }
+        }
+    }
+
+    std::vector<std::pair<std::string, std::pair<uint64_t, uint64_t>>> top(
+        funcs.begin(), funcs.end());
+    std::sort(top.begin(), top.end(), [](const decltype(top)::value_type& a,
+                                         const decltype(top)::value_type& b) {
+        return a.second.first != b.second.first
+                   ? a.second.first > b.second.first
+                   : a.second.second > b.second.second;
+    });
+    if (top.size() > n) top.resize(n);
+
+    std::string result;
+    char buf[96];
+    snprintf(buf, sizeof(buf), "%10s %7s %10s %7s  %s\n", "self", "self%",
+             "total", "total%", "function");
+    result.append(buf);
+    double base = sample_cnt == 0 ? 1.0 : static_cast<double>(sample_cnt);
+    for (const auto& it : top) {
+        snprintf(buf, sizeof(buf), "%10llu %6.2f%% %10llu %6.2f%%  ",
+                 static_cast<unsigned long long>(it.second.first),  // NOLINT
+                 100.0 * it.second.first / base,
+                 static_cast<unsigned long long>(it.second.second),  // NOLINT
+                 100.0 * it.second.second / base);
+        result.append(buf).append(it.first).append("\n");
+    }
+    return result;
+}
+
+void CpuProfiler::Reset() {
+    Aggregate();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stacks.clear();
+    m_dropped.store(0, std::memory_order_relaxed);
+}
+
+uint64_t CpuProfiler::SampleCount() {
+    Aggregate();
+    uint64_t cnt = 0;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& it : m_stacks) cnt += it.second;
+    return cnt;
+}
+
+}  // namespace cbase
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <signal.h>
+#include <sys/types.h>
+#include <time.h>
+#include <atomic>
+#include <condition_variable>  // NOLINT
+#include <cstdint>
+#include <map>
+#include <mutex>  // NOLINT
+#include <string>
+#include <thread>  // NOLINT
+#include <vector>
+
+namespace cbase {
+
+// Sampling CPU profiler. Every registered thread owns a CPU time timer that
+// raises SIGPROF, the handler captures the raw stack into a per-thread ring
+// and a background thread aggregates the rings. Symbolization only happens
+// when a report is built.
+//
+//   CpuProfiler::Instance().RegisterThread();  // in each thread to sample
+//   CpuProfiler::Instance().Start(100);
+//   ...
+//   CpuProfiler::Instance().Stop();
+//   std::string folded = CpuProfiler::Instance().FoldedStacks();
+class CpuProfiler {
+public:
+    static constexpr int kMaxThreads = 256;
+    static constexpr int kMaxDepth   = 64;
+    static constexpr int kRingSize   = 256;  // samples per thread
+
+    static CpuProfiler& Instance();
+
+    CpuProfiler(const CpuProfiler&) = delete;
+    CpuProfiler& operator=(const CpuProfiler&) = delete;
+
+    // samples frequency_hz times per second of thread CPU time
+    bool Start(int frequency_hz = 100);
+    void Stop();
+    bool IsRunning() const noexcept {
+        return m_running.load(std::memory_order_acquire);
+    }
+
+    // registers the calling thread, it is unregistered at thread exit
+    bool RegisterThread();
+    void UnregisterThread();
+
+    // "root;caller;leaf count" lines, input of flamegraph.pl
+    std::string FoldedStacks();
+    // the n functions with most self samples, with their total samples
+    std::string TopFunctions(size_t n);
+    void Reset();
+
+    uint64_t SampleCount();
+    // samples lost because a ring was full
+    uint64_t DroppedCount() const noexcept {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Sample {
+        int m_depth;
+        void* m_frames[kMaxDepth];
+    };
+
+    // single producer(signal handler) single consumer(aggregator) ring
+    struct ThreadSlot {
+        pid_t m_tid;
+        timer_t m_timer;
+        std::atomic<uint64_t> m_head{0};
+        std::atomic<uint64_t> m_tail{0};
+        Sample m_samples[kRingSize];
+    };
+
+    CpuProfiler();
+    ~CpuProfiler() {}
+
+    static void SignalHandler(int signo, siginfo_t* info, void* context);
+    static void Record(ThreadSlot* slot, void* pc);
+
+    bool ArmTimer(ThreadSlot* slot, int frequency_hz);
+    void Aggregate();
+    void Drain(ThreadSlot* slot);  // with m_mutex held
+
+private:
+    std::atomic<bool> m_running;
+    std::atomic<uint64_t> m_dropped;
+    int m_frequency_hz;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::thread m_aggregator;
+    ThreadSlot* m_slots[kMaxThreads];
+    std::map<std::vector<void*>, uint64_t> m_stacks;
+};  // class CpuProfiler
+
+}  // namespace cbase
@@ -0,0 +1,497 @@
+#pragma once
+
+#include <chrono>              // NOLINT
+#include <condition_variable>  // NOLINT
+#include <cstdint>
+#include <memory>
+#include <mutex>  // NOLINT
+#include <utility>
+#include <vector>
+
+namespace cbase {
+
+// Blocking queue whose items become poppable at their deadline. Pending
+// items sit in a hierarchical timing wheel of kLevels x 256 slots, tick_ms
+// per tick at the lowest level: push and cancel are O(1), a consumer
+// sleeps until the next deadline and is woken early only by a push that
+// is due sooner. Items due beyond the wheel horizon (2^32 ticks) wait on
+// an overflow list. Nodes take 24 bytes plus Data, allocated in chunks and
+// reused, and linked by index.
+template <class Data>
+class delay_queue {
+public:
+    // 0 is never a valid id
+    using TimerId   = uint64_t;
+    using Clock     = std::chrono::steady_clock;
+    using TimePoint = Clock::time_point;
+
+    explicit delay_queue(uint32_t tick_ms = 1);
+    ~delay_queue() {}
+
+    delay_queue(const delay_queue&) = delete;
+    delay_queue& operator=(const delay_queue&) = delete;
+
+    TimerId push(const Data& data, uint32_t delay_ms) {
+        return push_at(data,
+                       Clock::now() + std::chrono::milliseconds(delay_ms));
+    }
+    TimerId push(Data&& data, uint32_t delay_ms) {
+        return push_at(std::move(data),
+                       Clock::now() + std::chrono::milliseconds(delay_ms));
+    }
+    TimerId push_at(const Data& data, TimePoint deadline) {
+        return push_impl(Data(data), deadline);
+    }
+    TimerId push_at(Data&& data, TimePoint deadline) {
+        return push_impl(std::move(data), deadline);
+    }
+
+    // false if id was already popped or cancelled
+    bool cancel(TimerId id);
+
+    // blocks until an item is due
+    void pop(Data& data);  // NOLINT
+    // false if nothing became due within timeout_ms
+    bool pop(Data& data, int timeout_ms);  // NOLINT
+    bool try_pop(Data& data);              // NOLINT
+
+    // pending and due items
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_pending + m_ready_cnt;
+    }
+
+    bool empty() const { return size() == 0; }
+
+private:
+    static constexpr int kLevels        = 4;
+    static constexpr int kSlotBits      = 8;
+    static constexpr int kSlots         = 1 << kSlotBits;
+    static constexpr uint32_t kNil      = UINT32_MAX;
+    static constexpr uint64_t kNever    = UINT64_MAX;
+    static constexpr uint32_t kChunkCnt = 4096;  // nodes per chunk
+
+    // m_where of a node outside the wheel
+    static constexpr uint16_t kFree     = 0xFFFF;
+    static constexpr uint16_t kReady    = 0xFFFE;
+    static constexpr uint16_t kOverflow = 0xFFFD;
+
+    struct Node {
+        uint64_t m_deadline = 0;  // tick
+        uint32_t m_prev     = kNil;
+        uint32_t m_next     = kNil;
+        uint32_t m_gen      = 1;
+        uint16_t m_where    = kFree;  // level * kSlots + slot
+        Data m_data;
+    };
+
+    TimerId push_impl(Data&& data, TimePoint deadline);
+
+    Node& At(uint32_t idx) noexcept {
+        return m_chunks[idx / kChunkCnt][idx % kChunkCnt];
+    }
+
+    uint64_t NowTick() const noexcept { return ToTick(Clock::now(), false); }
+    uint64_t ToTick(TimePoint time, bool round_up) const noexcept;
+    TimePoint TickTime(uint64_t tick) const noexcept {
+        return m_start + m_tick * tick;
+    }
+
+    uint32_t NewNode();
+    void FreeNode(uint32_t idx) noexcept;
+
+    uint32_t* HeadOf(uint16_t where) noexcept;
+    void Link(uint32_t idx, uint16_t where) noexcept;
+    void Unlink(uint32_t idx) noexcept;
+
+    // files idx under the slot its deadline maps to from m_current
+    void Place(uint32_t idx) noexcept;
+    void Advance(uint64_t now) noexcept;
+    void Cascade(int level, int slot) noexcept;
+    // first tick > m_current at which a cascade or an expiry happens
+    uint64_t NextEventTick() const noexcept;
+    // earliest pending deadline, may be early after a cancel
+    uint64_t NextDeadlineTick() const noexcept;
+    // first occupied slot of level at or after from, -1 if none
+    int FirstSlot(int level, int from) const noexcept;
+
+    bool PopReady(Data& data);  // NOLINT
+    bool WaitAndPop(Data& data, const TimePoint* timeout);  // NOLINT
+
+private:
+    const TimePoint m_start;
+    const std::chrono::milliseconds m_tick;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_condition_variable;
+    uint32_t m_waiters;
+    uint64_t m_wait_tick;  // tick the waiters sleep until
+
+    uint64_t m_current;  // every tick up to m_current is processed
+    size_t m_pending;    // items in the wheel and in overflow
+    size_t m_ready_cnt;
+
+    uint32_t m_slots[kLevels][kSlots];
+    uint64_t m_bitmap[kLevels][kSlots / 64];
+    uint64_t m_slot_min[kLevels][kSlots];  // unused for level 0
+    uint32_t m_overflow;
+    uint64_t m_overflow_min;
+    uint32_t m_ready_head;
+    uint32_t m_ready_tail;
+
+    std::vector<std::unique_ptr<Node[]>> m_chunks;
+    uint32_t m_node_cnt;
+    uint32_t m_free_head;
+};
+
+template <class Data>
+delay_queue<Data>::delay_queue(uint32_t tick_ms)
+    : m_start(Clock::now()),
+      m_tick(tick_ms == 0 ? 1 : tick_ms),
+      m_waiters(0),
+      m_wait_tick(kNever),
+      m_current(0),
+      m_pending(0),
+      m_ready_cnt(0),
+      m_overflow(kNil),
+      m_overflow_min(kNever),
+      m_ready_head(kNil),
+      m_ready_tail(kNil),
+      m_node_cnt(0),
+      m_free_head(kNil) {
+    for (int level = 0; level < kLevels; ++level) {
+        for (int slot = 0; slot < kSlots; ++slot) {
+            m_slots[level][slot]    = kNil;
+            m_slot_min[level][slot] = kNever;
+        }
+        for (auto& word : m_bitmap[level]) word = 0;
+    }
+}
+
+template <class Data>
+typename delay_queue<Data>::TimerId delay_queue<Data>::push_impl(
+    Data&& data, TimePoint deadline) {
+    bool notify = false;
+    TimerId id  = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        uint32_t idx    = NewNode();
+        Node& node      = At(idx);
+        node.m_data     = std::move(data);
+        node.m_deadline = ToTick(deadline, true);
+        id = (static_cast<uint64_t>(node.m_gen) << 32) | idx;
+        Advance(NowTick());
+        Place(idx);
+        notify = m_waiters > 0 &&
+                 (node.m_where == kReady || node.m_deadline < m_wait_tick);
+    }
+    if (notify) m_condition_variable.notify_one();
+    return id;
+}
+
+template <class Data>
+bool delay_queue<Data>::cancel(TimerId id) {
+    uint32_t idx = static_cast<uint32_t>(id);
+    uint32_t gen = static_cast<uint32_t>(id >> 32);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (idx >= m_node_cnt) return false;
+    Node& node = At(idx);
+    if (node.m_gen != gen || node.m_where == kFree) return false;
+    if (node.m_where == kReady) {
+        --m_ready_cnt;
+    } else {
+        --m_pending;
+    }
+    Unlink(idx);
+    FreeNode(idx);
+    return true;
+}
+
+template <class Data>
+void delay_queue<Data>::pop(Data& data) {  // NOLINT
+    WaitAndPop(data, nullptr);
+}
+
+template <class Data>
+bool delay_queue<Data>::pop(Data& data, int timeout_ms) {  // NOLINT
+    TimePoint timeout = Clock::now() + std::chrono::milliseconds(timeout_ms);
+    return WaitAndPop(data, &timeout);
+}
+
+template <class Data>
+bool delay_queue<Data>::try_pop(Data& data) {  // NOLINT
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Advance(NowTick());
+    return PopReady(data);
+}
+
+template <class Data>
+bool delay_queue<Data>::WaitAndPop(Data& data,  // NOLINT
+                                   const TimePoint* timeout) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        Advance(NowTick());
+        if (PopReady(data)) {
+            bool more = m_ready_cnt > 0 && m_waiters > 0;
+            lock.unlock();
+            // hand the other due items to another waiter
+            if (more) m_condition_variable.notify_one();
+            return true;
+        }
+        uint64_t tick = NextDeadlineTick();
+        if (timeout != nullptr && Clock::now() >= *timeout) return false;
+
+        ++m_waiters;
+        if (tick < m_wait_tick) m_wait_tick = tick;
+        if (tick == kNever && timeout == nullptr) {
+            m_condition_variable.wait(lock);
+        } else {
+            TimePoint until = tick == kNever ? *timeout : TickTime(tick);
+            if (timeout != nullptr && *timeout < until) until = *timeout;
+            m_condition_variable.wait_until(lock, until);
+        }
+        // forget every target, the waiters still asleep may sleep longer
+        // than the next push allows, so pushes notify until one of them
+        // registers again
+        --m_waiters;
+        m_wait_tick = kNever;
+    }
+}
+
+template <class Data>
+bool delay_queue<Data>::PopReady(Data& data) {  // NOLINT
+    if (m_ready_head == kNil) return false;
+    uint32_t idx = m_ready_head;
+    data         = std::move(At(idx).m_data);
+    Unlink(idx);
+    FreeNode(idx);
+    --m_ready_cnt;
+    return true;
+}
+
+template <class Data>
+uint64_t delay_queue<Data>::ToTick(TimePoint time,
+                                   bool round_up) const noexcept {
+    if (time <= m_start) return 0;
+    auto elapsed = time - m_start;
+    auto ticks   = elapsed / m_tick;
+    if (round_up && m_tick * ticks < elapsed) ++ticks;
+    return static_cast<uint64_t>(ticks);
+}
+
+template <class Data>
+uint32_t delay_queue<Data>::NewNode() {
+    if (m_free_head == kNil) {
+        m_chunks.emplace_back(new Node[kChunkCnt]);
+        // chain the new chunk in reverse so that low indexes go first
+        for (uint32_t i = kChunkCnt; i > 0; --i) {
+            uint32_t idx   = m_node_cnt + i - 1;
+            At(idx).m_next = m_free_head;
+            m_free_head    = idx;
+        }
+        m_node_cnt += kChunkCnt;
+    }
+    uint32_t idx = m_free_head;
+    m_free_head  = At(idx).m_next;
+    return idx;
+}
+
+template <class Data>
+void delay_queue<Data>::FreeNode(uint32_t idx) noexcept {
+    Node& node   = At(idx);
+    node.m_data  = Data();
+    node.m_where = kFree;
+    node.m_prev  = kNil;
+    node.m_next  = m_free_head;
+    // a stale TimerId never matches a reused node
+    if (++node.m_gen == 0) node.m_gen = 1;
+    m_free_head = idx;
+}
+
+template <class Data>
+uint32_t* delay_queue<Data>::HeadOf(uint16_t where) noexcept {
+    if (where == kReady) return &m_ready_head;
+    if (where == kOverflow) return &m_overflow;
+    return &m_slots[where / kSlots][where % kSlots];
+}
+
+// slot lists are LIFO, the ready list is FIFO
+template <class Data>
+void delay_queue<Data>::Link(uint32_t idx, uint16_t where) noexcept {
+    Node& node   = At(idx);
+    node.m_where = where;
+    if (where == kReady) {
+        node.m_prev = m_ready_tail;
+        node.m_next = kNil;
+        if (m_ready_tail == kNil) {
+            m_ready_head = idx;
+        } else {
+            At(m_ready_tail).m_next = idx;
+        }
+        m_ready_tail = idx;
+        return;
+    }
+    uint32_t* head = HeadOf(where);
+    node.m_prev    = kNil;
+    node.m_next    = *head;
+    if (*head != kNil) At(*head).m_prev = idx;
+    *head = idx;
+    if (where != kOverflow) {
+        int level = where / kSlots;
+        int slot  = where % kSlots;
+        m_bitmap[level][slot / 64] |= uint64_t(1) << (slot % 64);
+    }
+}
+
+template <class Data>
+void delay_queue<Data>::Unlink(uint32_t idx) noexcept {
+    Node& node     = At(idx);
+    uint32_t* head = HeadOf(node.m_where);
+    if (node.m_prev == kNil) {
+        *head = node.m_next;
+    } else {
+        At(node.m_prev).m_next = node.m_next;
+    }
+    if (node.m_next != kNil) {
+        At(node.m_next).m_prev = node.m_prev;
+    } else if (node.m_where == kReady) {
+        m_ready_tail = node.m_prev;
+    }
+    if (*head == kNil && node.m_where != kReady &&
+        node.m_where != kOverflow) {
+        int level = node.m_where / kSlots;
+        int slot  = node.m_where % kSlots;
+        m_bitmap[level][slot / 64] &= ~(uint64_t(1) << (slot % 64));
+        m_slot_min[level][slot] = kNever;
+    }
+    node.m_prev = node.m_next = kNil;
+}
+
+// An item goes to the lowest level whose parent block it shares with
+// m_current, so a level only holds items of the current parent block and
+// always in slots after the current one.
+template <class Data>
+void delay_queue<Data>::Place(uint32_t idx) noexcept {
+    Node& node        = At(idx);
+    uint64_t deadline = node.m_deadline;
+    if (deadline <= m_current) {
+        Link(idx, kReady);
+        ++m_ready_cnt;
+        return;
+    }
+    ++m_pending;
+    for (int level = 0; level < kLevels; ++level) {
+        int parent_shift = (level + 1) * kSlotBits;
+        if ((deadline >> parent_shift) != (m_current >> parent_shift)) {
+            continue;
+        }
+        int slot = (deadline >> (level * kSlotBits)) & (kSlots - 1);
+        Link(idx, static_cast<uint16_t>(level * kSlots + slot));
+        uint64_t& slot_min = m_slot_min[level][slot];
+        if (deadline < slot_min) slot_min = deadline;
+        return;
+    }
+    Link(idx, kOverflow);
+    if (deadline < m_overflow_min) m_overflow_min = deadline;
+}
+
+template <class Data>
+void delay_queue<Data>::Cascade(int level, int slot) noexcept {
+    uint32_t idx = m_slots[level][slot];
+    m_slots[level][slot] = kNil;
+    m_bitmap[level][slot / 64] &= ~(uint64_t(1) << (slot % 64));
+    m_slot_min[level][slot] = kNever;
+    while (idx != kNil) {
+        uint32_t next = At(idx).m_next;
+        --m_pending;
+        Place(idx);
+        idx = next;
+    }
+}
+
+template <class Data>
+void delay_queue<Data>::Advance(uint64_t now) noexcept {
+    while (m_pending > 0) {
+        uint64_t tick = NextEventTick();
+        if (tick > now) break;
+        m_current = tick;
+        constexpr uint64_t kTopSpan = uint64_t(1) << (kLevels * kSlotBits);
+        if (tick % kTopSpan == 0 && m_overflow != kNil) {
+            uint32_t idx   = m_overflow;
+            m_overflow     = kNil;
+            m_overflow_min = kNever;
+            while (idx != kNil) {
+                uint32_t next = At(idx).m_next;
+                --m_pending;
+                Place(idx);
+                idx = next;
+            }
+        }
+        // from the top so that items cascade all the way down
+        for (int level = kLevels - 1; level > 0; --level) {
+            uint64_t span = uint64_t(1) << (level * kSlotBits);
+            if (tick % span != 0) continue;
+            Cascade(level, (tick >> (level * kSlotBits)) & (kSlots - 1));
+        }
+        int slot = tick & (kSlots - 1);
+        uint32_t idx = m_slots[0][slot];
+        while (idx != kNil) {
+            uint32_t next = At(idx).m_next;
+            Unlink(idx);
+            --m_pending;
+            Link(idx, kReady);
+            ++m_ready_cnt;
+            idx = next;
+        }
+    }
+    if (now > m_current) m_current = now;
+}
+
+template <class Data>
+int delay_queue<Data>::FirstSlot(int level, int from) const noexcept {
+    for (int word = from / 64; word < kSlots / 64; ++word) {
+        uint64_t bits = m_bitmap[level][word];
+        if (word == from / 64) bits &= ~uint64_t(0) << (from % 64);
+        if (bits != 0) return word * 64 + __builtin_ctzll(bits);
+    }
+    return -1;
+}
+
+template <class Data>
+uint64_t delay_queue<Data>::NextEventTick() const noexcept {
+    for (int level = 0; level < kLevels; ++level) {
+        int shift = level * kSlotBits;
+        int from  = ((m_current >> shift) & (kSlots - 1)) + 1;
+        if (from >= kSlots) continue;
+        int slot = FirstSlot(level, from);
+        if (slot < 0) continue;
+        int parent_shift = shift + kSlotBits;
+        uint64_t parent  = m_current >> parent_shift << parent_shift;
+        return parent | (static_cast<uint64_t>(slot) << shift);
+    }
+    if (m_overflow == kNil) return kNever;
+    constexpr int kTopShift = kLevels * kSlotBits;
+    return ((m_current >> kTopShift) + 1) << kTopShift;
+}
+
+// lower levels hold earlier deadlines, and within a level the first
+// occupied slot holds the earliest ones
+template <class Data>
+uint64_t delay_queue<Data>::NextDeadlineTick() const noexcept {
+    if (m_pending == 0) return kNever;
+    for (int level = 0; level < kLevels; ++level) {
+        int shift = level * kSlotBits;
+        int from  = ((m_current >> shift) & (kSlots - 1)) + 1;
+        if (from >= kSlots) continue;
+        int slot = FirstSlot(level, from);
+        if (slot < 0) continue;
+        if (level == 0) {
+            return (m_current >> kSlotBits << kSlotBits) |
+                   static_cast<uint64_t>(slot);
+        }
+        return m_slot_min[level][slot];
+    }
+    return m_overflow_min;
+}
+
+}  // namespace cbase
@@ -0,0 +1,105 @@
+#include "epoch_reclaimer.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace cbase {
+
+EpochReclaimer::EpochReclaimer() : m_epoch(1), m_overflow_readers(0) {
+    for (auto& record : m_records) {
+        record.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+EpochReclaimer::~EpochReclaimer() {
+    ReclaimAll();
+    for (auto& record : m_records) {
+        delete record.load(std::memory_order_relaxed);
+    }
+}
+
+EpochReclaimer::Record* EpochReclaimer::CreateRecord(uint32_t index) {
+    // only the owning thread creates its record
+    Record* record = new Record();
+    m_records[index].store(record, std::memory_order_release);
+    return record;
+}
+
+void EpochReclaimer::Retire(void* ptr, ReclaimFunc reclaim, void* ctx) {
+    Retired retired;
+    retired.m_ptr     = ptr;
+    retired.m_reclaim = reclaim;
+    retired.m_ctx     = ctx;
+    retired.m_epoch   = m_epoch.load(std::memory_order_acquire);
+    uint32_t index    = ThisThreadIndex();
+    if (unlikely(index == kNoThreadIndex)) {
+        RetireShared(retired);
+        return;
+    }
+    Record* record = LocalRecord(index);
+    record->m_retired.push_back(retired);
+    if (++record->m_retire_cnt < kScanInterval) return;
+    record->m_retire_cnt = 0;
+    TryAdvance();
+    Collect(&record->m_retired);
+}
+
+// rare, so every call scans
+void EpochReclaimer::RetireShared(const Retired& retired) {
+    std::lock_guard<std::mutex> lock(m_overflow_mutex);
+    m_overflow_retired.push_back(retired);
+    TryAdvance();
+    Collect(&m_overflow_retired);
+}
+
+// the epoch moves on only when every thread inside a region has observed
+// the current one
+bool EpochReclaimer::TryAdvance() noexcept {
+    uint64_t epoch = m_epoch.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (const auto& slot : m_records) {
+        const Record* record = slot.load(std::memory_order_acquire);
+        if (record == nullptr) continue;
+        uint64_t observed = record->m_epoch.load(std::memory_order_acquire);
+        if (observed != 0 && observed != epoch) return false;
+    }
+    // their epoch is unknown, any of them may still see the oldest nodes
+    if (m_overflow_readers.load(std::memory_order_acquire) != 0) return false;
+    return m_epoch.compare_exchange_strong(epoch, epoch + 1,
+                                           std::memory_order_acq_rel,
+                                           std::memory_order_relaxed);
+}
+
+// nodes retired in epoch e are unreachable for everyone once the global
+// epoch reached e + 2
+void EpochReclaimer::Collect(std::vector<Retired>* retired) {
+    uint64_t epoch = m_epoch.load(std::memory_order_acquire);
+    auto pending   = std::partition(
+        retired->begin(), retired->end(),
+        [epoch](const Retired& node) { return node.m_epoch + 2 > epoch; });
+    for (auto it = pending; it != retired->end(); ++it) {
+        it->m_reclaim(it->m_ptr, it->m_ctx);
+    }
+    retired->erase(pending, retired->end());
+}
+
+void EpochReclaimer::ReclaimAll() {
+    for (auto& slot : m_records) {
+        Record* record = slot.load(std::memory_order_acquire);
+        if (record == nullptr) continue;
+        assert(record->m_depth == 0 && "reclaim all inside a guard.");
+        for (const Retired& node : record->m_retired) {
+            node.m_reclaim(node.m_ptr, node.m_ctx);
+        }
+        record->m_retired.clear();
+    }
+    std::lock_guard<std::mutex> lock(m_overflow_mutex);
+    assert(m_overflow_readers.load(std::memory_order_relaxed) == 0 &&
+           "reclaim all inside a guard.");
+    for (const Retired& node : m_overflow_retired) {
+        node.m_reclaim(node.m_ptr, node.m_ctx);
+    }
+    m_overflow_retired.clear();
+}
+
+}  // namespace cbase
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>  // NOLINT
+#include <vector>
+#include "thread_index.h"
+#include "utils.h"
+
+namespace cbase {
+
+// Epoch based reclamation. Readers enter a critical region through Guard,
+// writers unlink a node and Retire() it, the node is handed to its reclaim
+// function once every thread that could still see it has left its region.
+// Per-thread state lives in a slot indexed by ThisThreadIndex(). Threads
+// without a thread index are counted in one shared reader count, which
+// holds the epoch back while it is not zero, and retire to a shared list.
+class EpochReclaimer {
+public:
+    using ReclaimFunc = void (*)(void* ptr, void* ctx);
+
+    class Guard {
+    public:
+        explicit Guard(EpochReclaimer* reclaimer) : m_reclaimer(reclaimer) {
+            m_reclaimer->Enter();
+        }
+        ~Guard() { m_reclaimer->Exit(); }
+
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+
+    private:
+        EpochReclaimer* m_reclaimer;
+    };
+
+    EpochReclaimer();
+    // reclaims everything still retired, no thread may be inside a Guard
+    ~EpochReclaimer();
+
+    EpochReclaimer(const EpochReclaimer&) = delete;
+    EpochReclaimer& operator=(const EpochReclaimer&) = delete;
+
+    // regions nest, only the outermost one publishes the epoch
+    void Enter() {
+        uint32_t index = ThisThreadIndex();
+        if (unlikely(index == kNoThreadIndex)) {
+            m_overflow_readers.fetch_add(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            return;
+        }
+        Record* record = LocalRecord(index);
+        if (record->m_depth++ != 0) return;
+        record->m_epoch.store(m_epoch.load(std::memory_order_relaxed),
+                              std::memory_order_relaxed);
+        // the epoch must be visible before any shared pointer is read
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    void Exit() noexcept {
+        uint32_t index = ThisThreadIndex();
+        Record* record = index == kNoThreadIndex
+                             ? nullptr
+                             : m_records[index].load(std::memory_order_relaxed);
+        // the thread may have got its index after entering without one
+        if (unlikely(record == nullptr || record->m_depth == 0)) {
+            m_overflow_readers.fetch_sub(1, std::memory_order_release);
+            return;
+        }
+        if (--record->m_depth == 0) {
+            record->m_epoch.store(0, std::memory_order_release);
+        }
+    }
+
+    // ptr must already be unreachable for threads entering from now on
+    void Retire(void* ptr, ReclaimFunc reclaim, void* ctx);
+
+    // runs every pending reclaim, only when no thread is inside a Guard
+    void ReclaimAll();
+
+    uint64_t Epoch() const noexcept {
+        return m_epoch.load(std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr uint32_t kScanInterval = 64;
+
+    struct Retired {
+        void* m_ptr;
+        ReclaimFunc m_reclaim;
+        void* m_ctx;
+        uint64_t m_epoch;
+    };
+
+    // 0 in m_epoch means the thread is outside any region
+    struct Record {
+        std::atomic<uint64_t> m_epoch{0};
+        uint32_t m_depth     = 0;
+        uint32_t m_retire_cnt = 0;
+        std::vector<Retired> m_retired;
+        char m_padding[64];  // keep neighbour records off our cache line
+    };
+
+    Record* LocalRecord(uint32_t index) {
+        Record* record = m_records[index].load(std::memory_order_relaxed);
+        if (unlikely(record == nullptr)) record = CreateRecord(index);
+        return record;
+    }
+
+    Record* CreateRecord(uint32_t index);
+    void RetireShared(const Retired& retired);
+    bool TryAdvance() noexcept;
+    void Collect(std::vector<Retired>* retired);
+
+private:
+    std::atomic<uint64_t> m_epoch;
+    std::atomic<Record*> m_records[kMaxThreadIndex];
+
+    // threads without a thread index
+    std::atomic<uint32_t> m_overflow_readers;
+    std::mutex m_overflow_mutex;
+    std::vector<Retired> m_overflow_retired;
+};  // class EpochReclaimer
+
+}  // namespace cbase
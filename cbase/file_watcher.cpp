@@ -1,6 +1,7 @@
 #include "file_watcher.h"
 
 #include <cassert>
+#include <cerrno>
 
 namespace {
 static constexpr int BUFF_SIZE = (sizeof(struct inotify_event) + 4096) * 1024;
@@ -9,14 +10,17 @@ static constexpr int BUFF_SIZE = (sizeof(struct inotify_event) + 4096) * 1024;
 namespace cbase {
 
 FileWatcher::FileWatcher() {
-    m_inotify_fd = inotify_init();
+    m_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
     assert(m_inotify_fd > 0 && "inotify_init failed.");
     m_time_out.tv_sec  = 0;
     m_time_out.tv_usec = 1000;
     FD_ZERO(&m_fd_set);
 }
 
-FileWatcher::~FileWatcher() { m_watchings.clear(); }
+FileWatcher::~FileWatcher() {
+    m_watchings.clear();
+    if (m_inotify_fd >= 0) close(m_inotify_fd);
+}
 
 int FileWatcher::WatchDir(const std::string& dir, const ActionFunc& func,
                           uint32_t mask) {
@@ -66,19 +70,26 @@ void FileWatcher::Watching() {
     }
 
     if (FD_ISSET(m_inotify_fd, &m_fd_set)) {
-        char buf[BUFF_SIZE] = {0};
-        ssize_t length      = 0;
-        while ((length = read(m_inotify_fd, buf, sizeof(buf))) < 0 &&
-               errno == EINTR) {
-        }
+        HandleEvents();
+    }
+}
 
-        ssize_t index = 0;
-        while (index < length) {
-            struct inotify_event* event = (struct inotify_event*)(buf + index);
-            index += sizeof(struct inotify_event) + event->len;
-            HanldeEvent(event);
-        }
+int FileWatcher::HandleEvents() {
+    char buf[BUFF_SIZE] = {0};
+    ssize_t length      = 0;
+    while ((length = read(m_inotify_fd, buf, sizeof(buf))) < 0 &&
+           errno == EINTR) {
+    }
+
+    int cnt       = 0;
+    ssize_t index = 0;
+    while (index < length) {
+        struct inotify_event* event = (struct inotify_event*)(buf + index);
+        index += sizeof(struct inotify_event) + event->len;
+        HanldeEvent(event);
+        ++cnt;
     }
+    return cnt;
 }
 
 void FileWatcher::HanldeEvent(const struct inotify_event* event) {
@@ -39,8 +39,17 @@ public:
     int RmDir(const std::string& dir);
     bool RmWatch(int watchid);
 
+    // waits up to 1ms for events and dispatches them
     void Watching();
 
+    // non-blocking inotify fd, for an external poller such as
+    // Scheduler::Readable in coroutine.h
+    int Fd() const noexcept { return m_inotify_fd; }
+
+    // dispatches the events available now without waiting, returns how
+    // many were handled
+    int HandleEvents();
+
 private:
     void HanldeEvent(const struct inotify_event* event);
 
@@ -0,0 +1,133 @@
+#include "latency_histogram.h"
+
+#include <cmath>
+
+namespace cbase {
+
+void Histogram::Merge(const Histogram& other) noexcept {
+    for (uint32_t i = 0; i < kBucketCnt; ++i) {
+        m_counts[i] += other.m_counts[i];
+    }
+    m_total += other.m_total;
+    m_sum += other.m_sum;
+}
+
+void Histogram::Reset() noexcept {
+    m_counts.fill(0);
+    m_total = 0;
+    m_sum   = 0;
+}
+
+uint64_t Histogram::Min() const noexcept {
+    for (uint32_t i = 0; i < kBucketCnt; ++i) {
+        if (m_counts[i] != 0) return i == 0 ? 0 : BucketUpper(i - 1) + 1;
+    }
+    return 0;
+}
+
+uint64_t Histogram::Max() const noexcept {
+    for (uint32_t i = kBucketCnt; i > 0; --i) {
+        if (m_counts[i - 1] != 0) return BucketUpper(i - 1);
+    }
+    return 0;
+}
+
+uint64_t Histogram::Percentile(double percentile) const noexcept {
+    if (m_total == 0) return 0;
+    if (percentile < 0.0) percentile = 0.0;
+    if (percentile > 100.0) percentile = 100.0;
+
+    uint64_t rank = static_cast<uint64_t>(
+        std::ceil(percentile / 100.0 * static_cast<double>(m_total)));
+    if (rank == 0) rank = 1;
+
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < kBucketCnt; ++i) {
+        seen += m_counts[i];
+        if (seen >= rank) return BucketUpper(i);
+    }
+    return Max();
+}
+
+ConcurrentHistogram::ConcurrentHistogram() {
+    for (auto& shard : m_shards) {
+        shard.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+ConcurrentHistogram::~ConcurrentHistogram() {
+    for (auto& shard : m_shards) {
+        delete shard.load(std::memory_order_relaxed);
+    }
+}
+
+ConcurrentHistogram::Shard* ConcurrentHistogram::CreateShard(
+    uint32_t index) noexcept {
+    // only the owning thread creates its shard, a plain store is enough
+    Shard* shard = new Shard();
+    m_shards[index].store(shard, std::memory_order_release);
+    return shard;
+}
+
+void ConcurrentHistogram::RecordShared(uint64_t value) noexcept {
+    m_shared_shard.m_counts[Histogram::BucketIndex(value)].fetch_add(
+        1, std::memory_order_relaxed);
+    m_shared_shard.m_total.fetch_add(1, std::memory_order_relaxed);
+    m_shared_shard.m_sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+void ConcurrentHistogram::Cumulative(Histogram* histogram) const {
+    histogram->Reset();
+    auto add = [histogram](const Shard& shard) {
+        for (uint32_t i = 0; i < Histogram::kBucketCnt; ++i) {
+            histogram->m_counts[i] +=
+                shard.m_counts[i].load(std::memory_order_relaxed);
+        }
+        histogram->m_total += shard.m_total.load(std::memory_order_relaxed);
+        histogram->m_sum += shard.m_sum.load(std::memory_order_relaxed);
+    };
+    for (const auto& slot : m_shards) {
+        const Shard* shard = slot.load(std::memory_order_acquire);
+        if (shard != nullptr) add(*shard);
+    }
+    add(m_shared_shard);
+}
+
+// shards are read bucket by bucket while being written, so a bucket may be
+// newer than the total; the total is rebuilt from the buckets to stay
+// consistent with percentiles
+void ConcurrentHistogram::Subtract(Histogram* histogram,
+                                   const Histogram& base) {
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < Histogram::kBucketCnt; ++i) {
+        histogram->m_counts[i] -= base.m_counts[i];
+        total += histogram->m_counts[i];
+    }
+    histogram->m_total = total;
+    histogram->m_sum -= base.m_sum;
+}
+
+Histogram ConcurrentHistogram::Snapshot() const {
+    Histogram histogram;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Cumulative(&histogram);
+    Subtract(&histogram, m_reset_base);
+    return histogram;
+}
+
+Histogram ConcurrentHistogram::Interval() {
+    Histogram current;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Cumulative(&current);
+    Histogram interval = current;
+    Subtract(&interval, m_interval_base);
+    m_interval_base = current;
+    return interval;
+}
+
+void ConcurrentHistogram::Reset() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Cumulative(&m_reset_base);
+}
+
+}  // namespace cbase
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>  // NOLINT
+#include "thread_index.h"
+#include "time_elapser.h"
+
+namespace cbase {
+
+// Log-linear (HDR style) histogram of latencies in nanoseconds. Each power
+// of two range is split into 64 linear buckets, so a reported value is
+// within 1/64 (1.6%) of the recorded one. Values are clamped to 2^40 ns
+// (about 18 minutes). Not thread safe, see ConcurrentHistogram.
+class Histogram {
+public:
+    static constexpr uint32_t kSubBucketBits = 7;
+    static constexpr uint32_t kSubBucketHalf = 1u << (kSubBucketBits - 1);
+    static constexpr uint32_t kMaxValueBits  = 40;
+    static constexpr uint64_t kMaxValue = (uint64_t(1) << kMaxValueBits) - 1;
+    static constexpr uint32_t kBucketCnt =
+        (kMaxValueBits - kSubBucketBits + 2) * kSubBucketHalf;
+
+    Histogram() { Reset(); }
+
+    static uint32_t BucketIndex(uint64_t value) noexcept {
+        if (value > kMaxValue) value = kMaxValue;
+        if (value < 2 * kSubBucketHalf) return static_cast<uint32_t>(value);
+        uint32_t msb   = 63 - __builtin_clzll(value);
+        uint32_t shift = msb - kSubBucketBits + 1;
+        return shift * kSubBucketHalf + static_cast<uint32_t>(value >> shift);
+    }
+
+    // highest value that lands in bucket index
+    static uint64_t BucketUpper(uint32_t index) noexcept {
+        if (index < 2 * kSubBucketHalf) return index;
+        uint32_t shift = index / kSubBucketHalf - 1;
+        uint64_t sub   = index % kSubBucketHalf + kSubBucketHalf;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    void Record(uint64_t value, uint64_t cnt = 1) noexcept {
+        m_counts[BucketIndex(value)] += cnt;
+        m_total += cnt;
+        m_sum += value * cnt;
+    }
+
+    void Merge(const Histogram& other) noexcept;
+    void Reset() noexcept;
+
+    uint64_t Count() const noexcept { return m_total; }
+    uint64_t Sum() const noexcept { return m_sum; }
+    double Mean() const noexcept {
+        return m_total == 0 ? 0.0 : static_cast<double>(m_sum) / m_total;
+    }
+    // bucket precision, 0 if empty
+    uint64_t Min() const noexcept;
+    uint64_t Max() const noexcept;
+
+    // percentile in [0, 100], e.g. 99.9
+    uint64_t Percentile(double percentile) const noexcept;
+
+    uint64_t BucketCount(uint32_t index) const noexcept {
+        return m_counts[index];
+    }
+
+private:
+    friend class ConcurrentHistogram;
+
+    std::array<uint64_t, kBucketCnt> m_counts;
+    uint64_t m_total;
+    uint64_t m_sum;
+};  // class Histogram
+
+// Histogram recorded from many threads. Each thread writes its own shard
+// with plain loads and stores, no atomic read-modify-write and no shared
+// cache line. Readers merge the shards into a Histogram.
+class ConcurrentHistogram {
+public:
+    ConcurrentHistogram();
+    ~ConcurrentHistogram();
+
+    ConcurrentHistogram(const ConcurrentHistogram&) = delete;
+    ConcurrentHistogram& operator=(const ConcurrentHistogram&) = delete;
+
+    void Record(uint64_t value) noexcept {
+        uint32_t index = ThisThreadIndex();
+        if (unlikely(index == kNoThreadIndex)) {
+            RecordShared(value);
+            return;
+        }
+        // a shard is only created and written by its own thread
+        Shard* shard = m_shards[index].load(std::memory_order_relaxed);
+        if (unlikely(shard == nullptr)) shard = CreateShard(index);
+
+        Increase(&shard->m_counts[Histogram::BucketIndex(value)], 1);
+        Increase(&shard->m_total, 1);
+        Increase(&shard->m_sum, value);
+    }
+
+    // everything recorded since construction or the last Reset()
+    Histogram Snapshot() const;
+
+    // everything recorded since the previous Interval() call
+    Histogram Interval();
+
+    // Snapshot() starts from zero again. Recording threads are not
+    // disturbed, the current totals only become the new baseline.
+    void Reset();
+
+private:
+    struct Shard {
+        std::array<std::atomic<uint64_t>, Histogram::kBucketCnt> m_counts{};
+        std::atomic<uint64_t> m_total{0};
+        std::atomic<uint64_t> m_sum{0};
+    };
+
+    // single writer, so a load and a store instead of fetch_add
+    static void Increase(std::atomic<uint64_t>* counter,
+                         uint64_t delta) noexcept {
+        counter->store(counter->load(std::memory_order_relaxed) + delta,
+                       std::memory_order_relaxed);
+    }
+
+    Shard* CreateShard(uint32_t index) noexcept;
+    // threads without a thread index share one shard with fetch_add
+    void RecordShared(uint64_t value) noexcept;
+    // sum of all shards since construction
+    void Cumulative(Histogram* histogram) const;
+    static void Subtract(Histogram* histogram, const Histogram& base);
+
+private:
+    std::atomic<Shard*> m_shards[kMaxThreadIndex];
+    Shard m_shared_shard;
+
+    mutable std::mutex m_mutex;  // readers only
+    Histogram m_reset_base;
+    Histogram m_interval_base;
+};  // class ConcurrentHistogram
+
+// records the lifetime of the scope into histogram
+class ScopedLatencyTimer {
+public:
+    explicit ScopedLatencyTimer(ConcurrentHistogram* histogram)
+        : m_histogram(histogram) {}
+    ~ScopedLatencyTimer() { m_histogram->Record(m_elapser.ElapseNanos()); }
+
+    ScopedLatencyTimer(const ScopedLatencyTimer&) = delete;
+    ScopedLatencyTimer& operator=(const ScopedLatencyTimer&) = delete;
+
+private:
+    ConcurrentHistogram* m_histogram;
+    TimeElapser m_elapser;
+};  // class ScopedLatencyTimer
+
+}  // namespace cbase
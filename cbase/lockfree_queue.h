@@ -1,30 +1,61 @@
 #pragma once
 
+#include <array>
 #include <atomic>
 #include <cassert>
+#include <chrono>  // NOLINT
 #include <cstdint>
 #include <cstdio>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
+#include "wait_strategy.h"
 
 namespace cbase {
 
-template <class Data, std::size_t N = 10000>
+// Bounded MPMC queue. Each block carries the position it is ready for:
+// pos when free for the producer of pos, pos + 1 once written for the
+// consumer of pos, pos + N once read, which frees it for the next round.
+// Nobody waits for a half done write or read: a producer sees the block
+// as full and a consumer sees it as empty.
+//
+// The blocking overloads wait with Wait, see wait_strategy.h, a negative
+// timeout_ms waits forever.
+template <class Data, std::size_t N = 10000,
+          class Wait = spin_yield_wait<>>
 class lockfree_queue {
+    // with one block the written seq pos + 1 is also the free seq pos + N
+    static_assert(N >= 2, "lockfree_queue needs at least two blocks");
+
 public:
-    lockfree_queue() : m_max_cnt(N), m_head(0), m_tail(0) {}
+    lockfree_queue() : m_max_cnt(N), m_head(0), m_tail(0) {
+        for (std::size_t i = 0; i < N; ++i) {
+            m_blocks[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
     ~lockfree_queue() {}
 
     lockfree_queue(const lockfree_queue&) = delete;
     lockfree_queue& operator=(const lockfree_queue&) = delete;
 
+    // -1 if full
     int push(const Data& data);
+    int push(Data&& data);
+    // -1 if still full after timeout_ms
+    int push(const Data& data, int timeout_ms);
+    int push(Data&& data, int timeout_ms);
+
+    // -1 if empty
     int pop(Data& data);  // NOLINT
+    // -1 if still empty after timeout_ms
+    int pop(Data& data, int timeout_ms);  // NOLINT
 
     size_t size() const noexcept {
-        return used_cnt(m_head.load(std::memory_order_relaxed),
-                        m_tail.load(std::memory_order_relaxed));
+        // head first, it never passes the tail read after it
+        uint64_t head = m_head.load(std::memory_order_relaxed);
+        uint64_t tail = m_tail.load(std::memory_order_relaxed);
+        return used_cnt(head, tail);
     }
 
 private:
@@ -35,64 +66,140 @@ private:
         return tail - head;
     }
 
+    static wait_clock::time_point deadline(int timeout_ms) {
+        if (timeout_ms < 0) return wait_clock::time_point::max();
+        return wait_clock::now() + std::chrono::milliseconds(timeout_ms);
+    }
+
+    // the next push or pop would find its block ready
+    bool writable() const noexcept {
+        uint64_t tail = m_tail.load(std::memory_order_relaxed);
+        return m_blocks[get_idx(tail)].seq.load(std::memory_order_acquire) ==
+               tail;
+    }
+    bool readable() const noexcept {
+        uint64_t head = m_head.load(std::memory_order_relaxed);
+        return m_blocks[get_idx(head)].seq.load(std::memory_order_acquire) ==
+               head + 1;
+    }
+
 private:
     struct Block {
-        std::atomic<int> write_fin = {0};
+        std::atomic<uint64_t> seq = {0};
         Data data;
-
-        bool Readable() const noexcept {
-            return write_fin.load(std::memory_order_acquire) == 1;
-        }
-
-        void SetData(const Data& data) noexcept {
-            this->data = data;
-            write_fin.store(1, std::memory_order_release);
-        }
-
-        void GetData(Data& data) noexcept {  // NOLINT
-            write_fin.store(0, std::memory_order_release);
-            data = this->data;
-        }
     };
 
+    template <class D>
+    int push_impl(D&& data);
+    template <class D>
+    int push_wait(D&& data, int timeout_ms);
+
     const uint64_t m_max_cnt;
     std::atomic<uint64_t> m_head;
     std::atomic<uint64_t> m_tail;
     std::array<Block, N> m_blocks;
+    Wait m_not_empty;
+    Wait m_not_full;
 };
 
-template <class Data, std::size_t N>
-int lockfree_queue<Data, N>::push(const Data& data) {
-    uint64_t tail = 0;
-    do {
-        tail          = m_tail.load(std::memory_order_relaxed);
-        uint64_t head = m_head.load(std::memory_order_relaxed);
-        uint64_t cnt  = used_cnt(head, tail + 1);
-        if (cnt + 1 > m_max_cnt) return -1;
-    } while (!m_tail.compare_exchange_weak(
-        tail, tail + 1, std::memory_order_release, std::memory_order_relaxed));
-
-    // tail-1 对应的idx就是用来放data
-    tail = get_idx(tail - 1);
-    m_blocks[tail].SetData(data);
+template <class Data, std::size_t N, class Wait>
+int lockfree_queue<Data, N, Wait>::push(const Data& data) {
+    return push_impl(data);
+}
+
+template <class Data, std::size_t N, class Wait>
+int lockfree_queue<Data, N, Wait>::push(Data&& data) {
+    return push_impl(std::move(data));
+}
+
+template <class Data, std::size_t N, class Wait>
+int lockfree_queue<Data, N, Wait>::push(const Data& data, int timeout_ms) {
+    return push_wait(data, timeout_ms);
+}
+
+template <class Data, std::size_t N, class Wait>
+int lockfree_queue<Data, N, Wait>::push(Data&& data, int timeout_ms) {
+    return push_wait(std::move(data), timeout_ms);
+}
+
+template <class Data, std::size_t N, class Wait>
+template <class D>
+int lockfree_queue<Data, N, Wait>::push_impl(D&& data) {
+    uint64_t tail = m_tail.load(std::memory_order_relaxed);
+    Block* block  = nullptr;
+    while (true) {
+        block        = &m_blocks[get_idx(tail)];
+        uint64_t seq = block->seq.load(std::memory_order_acquire);
+        if (seq == tail) {
+            if (m_tail.compare_exchange_weak(tail, tail + 1,
+                                             std::memory_order_relaxed,
+                                             std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (seq < tail) {
+            // still holds the data of the previous round
+            return -1;
+        } else {
+            tail = m_tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    block->data = std::forward<D>(data);
+    block->seq.store(tail + 1, std::memory_order_release);
+    m_not_empty.notify();
     return 0;
 }
 
-template <class Data, std::size_t N>
-int lockfree_queue<Data, N>::pop(Data& data) {  // NOLINT
-    uint64_t head = 0;
-    do {
-        head          = m_head.load(std::memory_order_relaxed);
-        uint64_t tail = m_tail.load(std::memory_order_relaxed);
-        uint64_t cnt  = used_cnt(head, tail);
-        if (cnt == 0) return -1;
-    } while (!m_head.compare_exchange_weak(
-        head, head + 1, std::memory_order_release, std::memory_order_relaxed));
+template <class Data, std::size_t N, class Wait>
+template <class D>
+int lockfree_queue<Data, N, Wait>::push_wait(D&& data, int timeout_ms) {
+    wait_clock::time_point until = deadline(timeout_ms);
+    // push_impl only moves from data once it got a block
+    while (push_impl(std::forward<D>(data)) != 0) {
+        if (!m_not_full.wait([this] { return writable(); }, until)) {
+            return push_impl(std::forward<D>(data));
+        }
+    }
+    return 0;
+}
 
-    head = get_idx(head - 1);
-    while (!m_blocks[head].Readable()) {
+template <class Data, std::size_t N, class Wait>
+int lockfree_queue<Data, N, Wait>::pop(Data& data) {  // NOLINT
+    uint64_t head = m_head.load(std::memory_order_relaxed);
+    Block* block  = nullptr;
+    while (true) {
+        block        = &m_blocks[get_idx(head)];
+        uint64_t seq = block->seq.load(std::memory_order_acquire);
+        if (seq == head + 1) {
+            if (m_head.compare_exchange_weak(head, head + 1,
+                                             std::memory_order_relaxed,
+                                             std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (seq < head + 1) {
+            // not written yet
+            return -1;
+        } else {
+            head = m_head.load(std::memory_order_relaxed);
+        }
+    }
+
+    // moves out, so move-only Data such as task can be queued
+    data = std::move(block->data);
+    block->seq.store(head + m_max_cnt, std::memory_order_release);
+    m_not_full.notify();
+    return 0;
+}
+
+template <class Data, std::size_t N, class Wait>
+int lockfree_queue<Data, N, Wait>::pop(Data& data,  // NOLINT
+                                       int timeout_ms) {
+    wait_clock::time_point until = deadline(timeout_ms);
+    while (pop(data) != 0) {
+        if (!m_not_empty.wait([this] { return readable(); }, until)) {
+            return pop(data);
+        }
     }
-    m_blocks[head].GetData(data);
     return 0;
 }
 
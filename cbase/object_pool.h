@@ -0,0 +1,344 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>  // NOLINT
+#include <new>
+#include <vector>
+#include "utils.h"
+
+namespace cbase {
+
+// Fixed-size slab pool for objects of type T. Each thread allocates from
+// and frees into its own cache without any lock or atomic RMW. A cache that
+// grows beyond kMaxCachedSlots, typically because the thread frees objects
+// allocated elsewhere, hands half of its slots to a lock-free return stack
+// that empty caches drain in one exchange. Only carving a new chunk takes
+// the mutex. Chunks are never given back to the system.
+template <class T>
+class ObjectPool {
+public:
+    struct Stats {
+        uint64_t m_allocs;      // Allocate calls
+        uint64_t m_cache_hits;  // served by the thread cache directly
+        uint64_t m_live;        // allocated and not deallocated yet
+        uint64_t m_chunks;
+
+        double HitRate() const noexcept {
+            return m_allocs == 0 ? 0.0
+                                 : static_cast<double>(m_cache_hits) /
+                                       static_cast<double>(m_allocs);
+        }
+    };
+
+    static ObjectPool& Instance() {
+        static ObjectPool* pool = new ObjectPool();  // never destroyed
+        return *pool;
+    }
+
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    // returns uninitialized storage for one T
+    void* Allocate() {
+        ThreadCache* cache = LocalCache();
+        if (unlikely(cache == nullptr)) return AllocateUncached();
+        Bump(&cache->m_allocs);
+        if (likely(cache->m_free != nullptr)) {
+            Bump(&cache->m_hits);
+        } else {
+            Refill(cache);
+        }
+        Slot* slot     = cache->m_free;
+        cache->m_free  = slot->m_next;
+        cache->m_count -= 1;
+        return slot;
+    }
+
+    // ptr may come from any thread
+    void Deallocate(void* ptr) noexcept {
+        if (ptr == nullptr) return;
+        Slot* slot         = static_cast<Slot*>(ptr);
+        ThreadCache* cache = LocalCache();
+        if (unlikely(cache == nullptr)) {
+            m_uncached_frees.fetch_add(1, std::memory_order_relaxed);
+            PushReturned(slot, slot);
+            return;
+        }
+        Bump(&cache->m_frees);
+        slot->m_next  = cache->m_free;
+        cache->m_free = slot;
+        if (unlikely(++cache->m_count > kMaxCachedSlots)) {
+            Flush(cache, kMaxCachedSlots / 2);
+        }
+    }
+
+    // counters of exited threads are included, a snapshot taken while
+    // other threads allocate is approximate
+    Stats GetStats() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        uint64_t allocs = m_retired_allocs +
+                          m_uncached_allocs.load(std::memory_order_relaxed);
+        uint64_t frees = m_retired_frees +
+                         m_uncached_frees.load(std::memory_order_relaxed);
+        uint64_t hits = m_retired_hits;
+        for (const ThreadCache* cache = m_caches; cache != nullptr;
+             cache                    = cache->m_next_cache) {
+            allocs += cache->m_allocs.load(std::memory_order_relaxed);
+            frees += cache->m_frees.load(std::memory_order_relaxed);
+            hits += cache->m_hits.load(std::memory_order_relaxed);
+        }
+        Stats stats;
+        stats.m_allocs     = allocs;
+        stats.m_cache_hits = hits;
+        stats.m_live       = allocs > frees ? allocs - frees : 0;
+        stats.m_chunks     = m_chunks.size();
+        return stats;
+    }
+
+private:
+    static constexpr std::size_t kSlotsPerChunk  = 64;
+    static constexpr std::size_t kMaxCachedSlots = 256;
+
+    union Slot {
+        Slot* m_next;
+        alignas(T) unsigned char m_storage[sizeof(T)];
+    };
+
+    // counters are only written by the owner thread
+    struct ThreadCache {
+        Slot* m_free        = nullptr;
+        std::size_t m_count = 0;
+        std::atomic<uint64_t> m_allocs{0};
+        std::atomic<uint64_t> m_frees{0};
+        std::atomic<uint64_t> m_hits{0};
+        ThreadCache* m_next_cache = nullptr;
+    };
+
+    // gives the cache back when its thread exits
+    struct CacheHolder {
+        ~CacheHolder() {
+            if (t_cache != nullptr) Instance().ReleaseCache(t_cache);
+            t_cache  = nullptr;
+            t_exited = true;
+        }
+    };
+
+    ObjectPool()
+        : m_returned(nullptr),
+          m_uncached_allocs(0),
+          m_uncached_frees(0),
+          m_caches(nullptr),
+          m_retired_allocs(0),
+          m_retired_frees(0),
+          m_retired_hits(0) {}
+    ~ObjectPool() {
+        for (Slot* chunk : m_chunks) delete[] chunk;
+    }
+
+    static void Bump(std::atomic<uint64_t>* counter) noexcept {
+        counter->store(counter->load(std::memory_order_relaxed) + 1,
+                       std::memory_order_relaxed);
+    }
+
+    // nullptr once the calling thread runs its thread_local destructors
+    ThreadCache* LocalCache() {
+        ThreadCache* cache = t_cache;
+        if (likely(cache != nullptr)) return cache;
+        if (t_exited) return nullptr;
+        return CreateCache();
+    }
+
+    ThreadCache* CreateCache() {
+        static thread_local CacheHolder holder;
+        (void)holder;
+        ThreadCache* cache = new ThreadCache();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            cache->m_next_cache = m_caches;
+            m_caches            = cache;
+        }
+        t_cache = cache;
+        return cache;
+    }
+
+    void ReleaseCache(ThreadCache* cache) noexcept {
+        if (cache->m_free != nullptr) Flush(cache, cache->m_count);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_retired_allocs += cache->m_allocs.load(std::memory_order_relaxed);
+        m_retired_frees += cache->m_frees.load(std::memory_order_relaxed);
+        m_retired_hits += cache->m_hits.load(std::memory_order_relaxed);
+        ThreadCache** link = &m_caches;
+        while (*link != cache) link = &(*link)->m_next_cache;
+        *link = cache->m_next_cache;
+        delete cache;
+    }
+
+    // cache is empty, take every returned slot or carve a new chunk
+    void Refill(ThreadCache* cache) {
+        Slot* head = m_returned.exchange(nullptr, std::memory_order_acquire);
+        if (head != nullptr) {
+            std::size_t count = 0;
+            for (Slot* slot = head; slot != nullptr; slot = slot->m_next) {
+                ++count;
+            }
+            cache->m_free  = head;
+            cache->m_count = count;
+            return;
+        }
+        Slot* chunk = Grow();
+        for (std::size_t i = 0; i < kSlotsPerChunk; ++i) {
+            chunk[i].m_next = cache->m_free;
+            cache->m_free   = &chunk[i];
+        }
+        cache->m_count = kSlotsPerChunk;
+    }
+
+    // moves count slots from the cache to the return stack
+    void Flush(ThreadCache* cache, std::size_t count) noexcept {
+        Slot* first = cache->m_free;
+        Slot* last  = first;
+        for (std::size_t i = 1; i < count; ++i) last = last->m_next;
+        cache->m_free = last->m_next;
+        cache->m_count -= count;
+        PushReturned(first, last);
+    }
+
+    // push only, popped all at once by exchange, so no ABA
+    void PushReturned(Slot* first, Slot* last) noexcept {
+        Slot* head = m_returned.load(std::memory_order_relaxed);
+        do {
+            last->m_next = head;
+        } while (!m_returned.compare_exchange_weak(head, first,
+                                                   std::memory_order_release,
+                                                   std::memory_order_relaxed));
+    }
+
+    void* AllocateUncached() {
+        m_uncached_allocs.fetch_add(1, std::memory_order_relaxed);
+        Slot* head = m_returned.exchange(nullptr, std::memory_order_acquire);
+        if (head == nullptr) {
+            Slot* chunk = Grow();
+            for (std::size_t i = 0; i + 1 < kSlotsPerChunk; ++i) {
+                chunk[i].m_next = &chunk[i + 1];
+            }
+            chunk[kSlotsPerChunk - 1].m_next = nullptr;
+            head                             = &chunk[0];
+        }
+        if (head->m_next != nullptr) {
+            Slot* last = head->m_next;
+            while (last->m_next != nullptr) last = last->m_next;
+            PushReturned(head->m_next, last);
+        }
+        return head;
+    }
+
+    Slot* Grow() {
+        Slot* chunk = new Slot[kSlotsPerChunk];
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_chunks.push_back(chunk);
+        return chunk;
+    }
+
+private:
+    static thread_local ThreadCache* t_cache;
+    static thread_local bool t_exited;
+
+    std::atomic<Slot*> m_returned;
+    std::atomic<uint64_t> m_uncached_allocs;
+    std::atomic<uint64_t> m_uncached_frees;
+
+    mutable std::mutex m_mutex;  // guards the members below
+    std::vector<Slot*> m_chunks;
+    ThreadCache* m_caches;
+    uint64_t m_retired_allocs;
+    uint64_t m_retired_frees;
+    uint64_t m_retired_hits;
+};
+
+template <class T>
+thread_local typename ObjectPool<T>::ThreadCache* ObjectPool<T>::t_cache =
+    nullptr;
+
+template <class T>
+thread_local bool ObjectPool<T>::t_exited = false;
+
+// std allocator over ObjectPool, single element allocations are pooled and
+// larger ones go to operator new. Node based containers and
+// std::allocate_shared only ever ask for one element.
+//
+//   std::list<Item, cbase::pool_allocator<Item>> items;
+template <class T>
+class pool_allocator {
+public:
+    using value_type = T;
+
+    pool_allocator() noexcept {}
+    template <class U>
+    pool_allocator(const pool_allocator<U>&) noexcept {}  // NOLINT
+
+    T* allocate(std::size_t n) {
+        if (n == 1) {
+            return static_cast<T*>(ObjectPool<T>::Instance().Allocate());
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, std::size_t n) noexcept {
+        if (n == 1) {
+            ObjectPool<T>::Instance().Deallocate(ptr);
+        } else {
+            ::operator delete(ptr);
+        }
+    }
+};
+
+template <class T, class U>
+bool operator==(const pool_allocator<T>&, const pool_allocator<U>&) noexcept {
+    return true;
+}
+
+template <class T, class U>
+bool operator!=(const pool_allocator<T>&, const pool_allocator<U>&) noexcept {
+    return false;
+}
+
+// Monotonic arena over a caller provided buffer. Allocate only bumps an
+// offset, memory comes back all at once through Reset(). Not thread safe.
+class Arena {
+public:
+    Arena(void* buffer, std::size_t size)
+        : m_begin(static_cast<unsigned char*>(buffer)),
+          m_size(size),
+          m_used(0) {}
+    ~Arena() {}
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // nullptr if the arena is exhausted
+    void* Allocate(std::size_t size, std::size_t align) noexcept {
+        assert((align & (align - 1)) == 0 && "align must be power of 2.");
+        uintptr_t base    = reinterpret_cast<uintptr_t>(m_begin);
+        uintptr_t current = base + m_used;
+        uintptr_t aligned = (current + align - 1) & ~(uintptr_t)(align - 1);
+        if (aligned + size > base + m_size) return nullptr;
+        m_used = aligned + size - base;
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    // caller must have destroyed every object living in the arena
+    void Reset() noexcept { m_used = 0; }
+
+    std::size_t Used() const noexcept { return m_used; }
+    std::size_t Capacity() const noexcept { return m_size; }
+
+private:
+    unsigned char* const m_begin;
+    const std::size_t m_size;
+    std::size_t m_used;
+};
+
+}  // namespace cbase
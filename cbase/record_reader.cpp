@@ -0,0 +1,159 @@
+#include "record_reader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <thread>  // NOLINT
+#include "string_util.h"
+
+namespace cbase {
+
+namespace {
+const DelimiterSet& Newline() {
+    static const DelimiterSet newline('\n');
+    return newline;
+}
+}  // namespace
+
+RecordReader::RecordReader(const std::string& path)
+    : m_path(path),
+      m_fd(-1),
+      m_map(nullptr),
+      m_map_size(0),
+      m_begin(0),
+      m_end(0),
+      m_eof(false),
+      m_offset(0) {}
+
+RecordReader::~RecordReader() {
+    if (m_map != nullptr) munmap(m_map, m_map_size);
+    if (m_fd >= 0) close(m_fd);
+}
+
+bool RecordReader::Open() {
+    if (m_fd >= 0) return true;
+    m_fd = open(m_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_fd < 0) return false;
+
+    struct stat st;
+    if (fstat(m_fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* addr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+                          MAP_PRIVATE, m_fd, 0);
+        if (addr != MAP_FAILED) {
+            m_map      = static_cast<char*>(addr);
+            m_map_size = static_cast<size_t>(st.st_size);
+            madvise(m_map, m_map_size, MADV_SEQUENTIAL);
+            return true;
+        }
+    }
+
+    // an empty regular file ends up here too, it simply reads eof
+    posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    m_buffer.resize(kReadSize);
+    return true;
+}
+
+bool RecordReader::Next(std::string_view* line) {
+    if (m_map != nullptr) {
+        if (m_offset >= m_map_size) return false;
+        const char* begin = m_map + m_offset;
+        const char* end   = m_map + m_map_size;
+        const char* p     = Newline().FindFirst(begin, end);
+        *line             = std::string_view(begin, p - begin);
+        m_offset          = (p - m_map) + 1;
+        return true;
+    }
+
+    if (m_fd < 0) return false;
+    size_t scanned = m_begin;
+    while (true) {
+        const char* data = m_buffer.data();
+        const char* end  = data + m_end;
+        const char* p    = Newline().FindFirst(data + scanned, end);
+        if (p != end || (m_eof && m_begin < m_end)) {
+            size_t line_end = static_cast<size_t>(p - data);
+            *line   = std::string_view(data + m_begin, line_end - m_begin);
+            m_begin = std::min(m_end, line_end + 1);
+            return true;
+        }
+        if (m_eof) return false;
+        scanned = m_end - m_begin;
+        if (!FillBuffer()) return false;
+    }
+}
+
+// moves the pending bytes to the front then reads more after them
+bool RecordReader::FillBuffer() {
+    size_t pending = m_end - m_begin;
+    if (m_begin > 0) {
+        memmove(m_buffer.data(), m_buffer.data() + m_begin, pending);
+        m_begin = 0;
+        m_end   = pending;
+    }
+    if (m_buffer.size() - m_end < kReadSize / 2) {
+        m_buffer.resize(m_buffer.size() * 2);
+    }
+
+    ssize_t n = 0;
+    while ((n = read(m_fd, m_buffer.data() + m_end, m_buffer.size() - m_end)) <
+               0 &&
+           errno == EINTR) {
+    }
+    if (n < 0) return false;
+    if (n == 0) m_eof = true;
+    m_end += static_cast<size_t>(n);
+    return true;
+}
+
+void RecordReader::ParallelForEach(size_t thread_num, const LineFunc& func) {
+    if (m_map == nullptr || thread_num <= 1) {
+        if (m_map != nullptr) {
+            ForEachLine(std::string_view(m_map, m_map_size), 0, func);
+            return;
+        }
+        std::string_view line;
+        while (Next(&line)) func(0, line);
+        return;
+    }
+
+    // chunk i starts right after the first newline at or past i * size / n
+    std::vector<size_t> bounds(thread_num + 1, m_map_size);
+    bounds[0] = 0;
+    for (size_t i = 1; i < thread_num; ++i) {
+        size_t pos = std::max(bounds[i - 1], m_map_size / thread_num * i);
+        if (pos > 0 && pos < m_map_size) {
+            const char* p = Newline().FindFirst(m_map + pos - 1,
+                                                m_map + m_map_size);
+            pos = std::min(m_map_size, static_cast<size_t>(p - m_map) + 1);
+        }
+        bounds[i] = pos;
+    }
+
+    std::vector<std::thread> workers;
+    workers.reserve(thread_num);
+    for (size_t i = 0; i < thread_num; ++i) {
+        std::string_view chunk(m_map + bounds[i], bounds[i + 1] - bounds[i]);
+        workers.emplace_back(&RecordReader::ForEachLine, chunk, i,
+                             std::cref(func));
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void RecordReader::ForEachLine(std::string_view chunk, size_t worker,
+                               const LineFunc& func) {
+    const char* cur = chunk.data();
+    const char* end = chunk.data() + chunk.size();
+    while (cur < end) {
+        const char* p = Newline().FindFirst(cur, end);
+        func(worker, std::string_view(cur, p - cur));
+        cur = p + 1;
+    }
+}
+
+}  // namespace cbase
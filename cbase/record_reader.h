@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cbase {
+
+// Reads newline separated records of a file. Regular files are mmap'ed and
+// lines are views into the mapping; files that cannot be mapped (pipes,
+// /proc) are streamed with large reads. Lines never include the '\n'.
+//
+//   RecordReader reader(path);
+//   if (!reader.Open()) return;
+//   std::string_view line;
+//   while (reader.Next(&line)) { ... }
+class RecordReader {
+public:
+    // worker is in [0, thread_num), lines of one worker are in file order
+    using LineFunc = std::function<void(size_t worker, std::string_view line)>;
+
+    explicit RecordReader(const std::string& path);
+    ~RecordReader();
+
+    RecordReader(const RecordReader&) = delete;
+    RecordReader& operator=(const RecordReader&) = delete;
+
+    bool Open();
+
+    // line stays valid until the next call in streaming mode, as long as
+    // the reader lives in mmap mode
+    bool Next(std::string_view* line);
+
+    // Splits the file into thread_num chunks at newline boundaries and
+    // feeds each chunk to func from its own thread. Streamed files are
+    // processed by the calling thread as worker 0. Independent of Next().
+    void ParallelForEach(size_t thread_num, const LineFunc& func);
+
+    bool IsMapped() const noexcept { return m_map != nullptr; }
+
+private:
+    bool FillBuffer();
+    static void ForEachLine(std::string_view chunk, size_t worker,
+                            const LineFunc& func);
+
+private:
+    static constexpr size_t kReadSize = 1 << 20;
+
+    const std::string m_path;
+    int m_fd;
+
+    // mmap mode
+    char* m_map;
+    size_t m_map_size;
+
+    // streaming mode, [m_begin, m_end) of m_buffer is not consumed yet
+    std::vector<char> m_buffer;
+    size_t m_begin;
+    size_t m_end;
+    bool m_eof;
+
+    size_t m_offset;  // next line in mmap mode
+};  // class RecordReader
+
+}  // namespace cbase
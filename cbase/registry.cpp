@@ -1,26 +1,48 @@
-#include "xregistry.h"
-#include <iostream>
+#include "registry.h"
+#include <string>
+#include "async_logger.h"
 
 class B {
 public:
     B() = default;
+    explicit B(const std::string& tag) : m_tag(tag) {}
     virtual ~B() {}
-    virtual void Show() { std::cout << "this is B" << std::endl; }
+    virtual void Show() { CBASE_LOG_INFO("this is B%s", m_tag.c_str()); }
+
+protected:
+    std::string m_tag;
 };
 REGISTER_SUBCLASS(B, B);
 
 class D final : public B {
 public:
-    D()  = default;
+    D() = default;
+    explicit D(const std::string& tag) : B(tag) {}
     ~D() = default;
-    void Show() override { std::cout << "this is D" << std::endl; }
+    void Show() override { CBASE_LOG_INFO("this is D%s", m_tag.c_str()); }
 };
 REGISTER_SUBCLASS(B, D);
+REGISTER_SUBCLASS_WITH_ARGS(B, D, const std::string&);
 
 int main(int argc, char** argv) {
-    B* b1 = Registry<B>::Create("B");
-    B* b2 = Registry<B>::Create("D");
+    cbase::AsyncLogger::Instance().Start();
+    std::unique_ptr<B> b1(Registry<B>::Create("B"));
     b1->Show();
+
+    Registry<B>::Ptr b2 = Registry<B>::CreatePooled("D");
     b2->Show();
+
+    auto b3 = Registry<B, const std::string&>::CreatePooled("D", " pooled");
+    b3->Show();
+
+    alignas(std::max_align_t) char buffer[256];
+    cbase::Arena arena(buffer, sizeof(buffer));
+    {
+        auto b4 =
+            Registry<B, const std::string&>::CreateIn(&arena, "D", " arena");
+        b4->Show();
+    }
+    arena.Reset();
+    cbase::AsyncLogger::Instance().Stop();
     return 0;
 }
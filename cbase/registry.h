@@ -1,30 +1,146 @@
 #pragma once
 
 #include <functional>
+#include <memory>
+#include <new>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
+#include "object_pool.h"
 
-template <class T>
+// Args are the constructor arguments every registered subclass accepts,
+// e.g. Registry<Handler, int, const std::string&>.
+template <class T, class... Args>
 class Registry {
 public:
-    using Function = std::function<T*()>;
-    static T* Create(const std::string& name) {
-        if (factorys().count(name) == 0) return nullptr;
-        return factorys()[name]();
+    using Function = std::function<T*(Args...)>;
+
+    // deleter carried by Ptr, it knows the concrete type and where the
+    // storage came from (heap, object pool or arena)
+    class Deleter {
+    public:
+        using DestroyFunc = void (*)(T*);
+
+        Deleter() noexcept : m_destroy(nullptr) {}
+        explicit Deleter(DestroyFunc destroy) noexcept : m_destroy(destroy) {}
+
+        void operator()(T* obj) const noexcept {
+            if (obj != nullptr && m_destroy != nullptr) m_destroy(obj);
+        }
+
+    private:
+        DestroyFunc m_destroy;
+    };
+
+    using Ptr = std::unique_ptr<T, Deleter>;
+
+    // legacy interface, caller owns the returned object and must delete it
+    static T* Create(const std::string& name, Args... args) {
+        auto it = factorys().find(name);
+        if (it == factorys().end()) return nullptr;
+        return it->second.m_create(std::forward<Args>(args)...);
     }
 
+    // object storage comes from a per-type ObjectPool and goes back to it
+    // when Ptr is reset
+    static Ptr CreatePooled(const std::string& name, Args... args) {
+        auto it = factorys().find(name);
+        if (it == factorys().end()) return Ptr();
+        if (it->second.m_create_pooled == nullptr) {
+            return Ptr(it->second.m_create(std::forward<Args>(args)...),
+                       Deleter(&DestroyHeap));
+        }
+        return it->second.m_create_pooled(std::forward<Args>(args)...);
+    }
+
+    // object storage comes from arena, empty Ptr if the arena is exhausted.
+    // Ptr only destroys the object, memory is reclaimed by Arena::Reset.
+    static Ptr CreateIn(cbase::Arena* arena, const std::string& name,
+                        Args... args) {
+        auto it = factorys().find(name);
+        if (it == factorys().end()) return Ptr();
+        if (it->second.m_create_in == nullptr) return Ptr();
+        return it->second.m_create_in(arena, std::forward<Args>(args)...);
+    }
+
+    // custom factory, only Create and CreatePooled(falls back to heap)
+    // are available for it
     static bool Register(const std::string& name, const Function& function) {
-        factorys()[name] = function;
+        Entry& entry          = factorys()[name];
+        entry.m_create        = function;
+        entry.m_create_pooled = nullptr;
+        entry.m_create_in     = nullptr;
+        return true;
+    }
+
+    template <class Derived>
+    static bool RegisterSubclass(const std::string& name) {
+        static_assert(std::is_base_of<T, Derived>::value,
+                      "Derived should be subclass of T");
+        static_assert(std::is_constructible<Derived, Args...>::value,
+                      "Derived is not constructible from Args");
+
+        Entry& entry   = factorys()[name];
+        entry.m_create = [](Args... args) -> T* {
+            return new Derived(std::forward<Args>(args)...);
+        };
+        entry.m_create_pooled = &MakePooled<Derived>;
+        entry.m_create_in     = &MakeIn<Derived>;
         return true;
     }
 
 private:
-    static std::unordered_map<std::string, Function>& factorys() {
-        static std::unordered_map<std::string, Function> dict;
+    struct Entry {
+        Function m_create;
+        Ptr (*m_create_pooled)(Args...)           = nullptr;
+        Ptr (*m_create_in)(cbase::Arena*, Args...) = nullptr;
+    };
+
+    template <class Derived>
+    static Ptr MakePooled(Args... args) {
+        void* mem    = cbase::ObjectPool<Derived>::Instance().Allocate();
+        Derived* obj = new (mem) Derived(std::forward<Args>(args)...);
+        return Ptr(obj, Deleter(&DestroyPooled<Derived>));
+    }
+
+    template <class Derived>
+    static Ptr MakeIn(cbase::Arena* arena, Args... args) {
+        void* mem = arena->Allocate(sizeof(Derived), alignof(Derived));
+        if (mem == nullptr) return Ptr();
+        Derived* obj = new (mem) Derived(std::forward<Args>(args)...);
+        return Ptr(obj, Deleter(&DestroyIn<Derived>));
+    }
+
+    static void DestroyHeap(T* obj) { delete obj; }
+
+    template <class Derived>
+    static void DestroyPooled(T* obj) {
+        Derived* derived = static_cast<Derived*>(obj);
+        derived->~Derived();
+        cbase::ObjectPool<Derived>::Instance().Deallocate(derived);
+    }
+
+    template <class Derived>
+    static void DestroyIn(T* obj) {
+        static_cast<Derived*>(obj)->~Derived();
+    }
+
+    static std::unordered_map<std::string, Entry>& factorys() {
+        static std::unordered_map<std::string, Entry> dict;
         return dict;
     }
 };
 
 #define REGISTER_SUBCLASS(Base, Derived) \
     static bool Derived##result =        \
-        Registry<Base>::Register(#Derived, []() { return new Derived(); })
+        Registry<Base>::RegisterSubclass<Derived>(#Derived)
+
+#define REGISTRY_CONCAT_IMPL(a, b) a##b
+#define REGISTRY_CONCAT(a, b) REGISTRY_CONCAT_IMPL(a, b)
+
+// REGISTER_SUBCLASS_WITH_ARGS(Handler, EchoHandler, int, const std::string&)
+// one Derived may be registered once per constructor signature
+#define REGISTER_SUBCLASS_WITH_ARGS(Base, Derived, ...)                  \
+    static bool REGISTRY_CONCAT(Derived##args_result_, __LINE__) =       \
+        Registry<Base, __VA_ARGS__>::RegisterSubclass<Derived>(#Derived)
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <type_traits>
+#include "shared_memory.h"
+#include "utils.h"
+
+namespace cbase {
+
+// Snapshot cell for small trivially copyable state such as rates or
+// thresholds. A writer makes the sequence odd, stores in place and makes it
+// even again; a reader copies out and retries when the sequence moved. A
+// read neither allocates nor writes shared memory, concurrent writers are
+// serialized on the sequence.
+//
+// The data is copied word by word with relaxed atomics, so a torn copy is
+// never a data race and never reaches the caller. The cell holds no
+// pointers and all zero bytes is a valid cell, so it can live in memory
+// shared between processes, see SharedSeqlockCell.
+template <class T>
+class alignas(64) seqlock_cell {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "T is not trivially copyable");
+
+public:
+    // holds all zero bytes until the first store
+    seqlock_cell() noexcept : m_seq(0) { memset(m_words, 0, sizeof(m_words)); }
+    explicit seqlock_cell(const T& value) noexcept : m_seq(0) {
+        WriteWords(value);
+    }
+
+    seqlock_cell(const seqlock_cell&) = delete;
+    seqlock_cell& operator=(const seqlock_cell&) = delete;
+
+    T load() const noexcept {
+        T value;
+        load(&value);
+        return value;
+    }
+    void load(T* value) const noexcept {
+        while (!try_load(value)) cpu_relax();
+    }
+    // one attempt, false and value untouched if a writer got in the way
+    bool try_load(T* value) const noexcept;
+
+    void store(const T& value) noexcept {
+        uint64_t seq = WriterLock();
+        WriteWords(value);
+        __atomic_store_n(&m_seq, seq + 2, __ATOMIC_RELEASE);
+    }
+
+    // read-modify-write, func(T*) runs with other writers held off
+    template <class Func>
+    void update(Func func) {
+        uint64_t seq = WriterLock();
+        T value;
+        CopyOut(&value);
+        func(&value);
+        WriteWords(value);
+        __atomic_store_n(&m_seq, seq + 2, __ATOMIC_RELEASE);
+    }
+
+    // stores completed so far
+    uint64_t version() const noexcept {
+        return __atomic_load_n(&m_seq, __ATOMIC_ACQUIRE) / 2;
+    }
+
+private:
+    static constexpr std::size_t kWords = (sizeof(T) + 7) / 8;
+
+    uint64_t WriterLock() noexcept {
+        uint64_t seq = __atomic_load_n(&m_seq, __ATOMIC_RELAXED);
+        while ((seq & 1) != 0 ||
+               !__atomic_compare_exchange_n(&m_seq, &seq, seq + 1, true,
+                                            __ATOMIC_ACQUIRE,
+                                            __ATOMIC_RELAXED)) {
+            cpu_relax();
+            seq = __atomic_load_n(&m_seq, __ATOMIC_RELAXED);
+        }
+        // the odd sequence is visible before any word of the new value
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        return seq;
+    }
+
+    void WriteWords(const T& value) noexcept {
+        uint64_t words[kWords] = {0};
+        memcpy(words, &value, sizeof(T));
+        for (std::size_t i = 0; i < kWords; ++i) {
+            __atomic_store_n(&m_words[i], words[i], __ATOMIC_RELAXED);
+        }
+    }
+
+    void CopyOut(T* value) const noexcept {
+        uint64_t words[kWords];
+        for (std::size_t i = 0; i < kWords; ++i) {
+            words[i] = __atomic_load_n(&m_words[i], __ATOMIC_RELAXED);
+        }
+        memcpy(value, words, sizeof(T));
+    }
+
+private:
+    uint64_t m_seq;  // odd while a store is in progress
+    uint64_t m_words[kWords];
+};
+
+template <class T>
+bool seqlock_cell<T>::try_load(T* value) const noexcept {
+    uint64_t before = __atomic_load_n(&m_seq, __ATOMIC_ACQUIRE);
+    if ((before & 1) != 0) return false;
+
+    uint64_t words[kWords];
+    for (std::size_t i = 0; i < kWords; ++i) {
+        words[i] = __atomic_load_n(&m_words[i], __ATOMIC_RELAXED);
+    }
+    // the words are read before the sequence is checked again
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&m_seq, __ATOMIC_RELAXED) != before) return false;
+
+    memcpy(value, words, sizeof(T));
+    return true;
+}
+
+// seqlock_cell in a named SharedMemory segment, or in a file with
+// Backing::kFile. Every process that calls Init() with the same name and T
+// shares the cell. A writer that dies inside Store leaves the sequence odd
+// and readers spinning; TryLoad lets a reader bound that.
+template <class T>
+class SharedSeqlockCell {
+public:
+    explicit SharedSeqlockCell(
+        const std::string& name,
+        SharedMemory::Backing backing = SharedMemory::Backing::kShm)
+        : m_name(name),
+          m_backing(backing),
+          m_shared_memory(nullptr),
+          m_segment(nullptr) {}
+    ~SharedSeqlockCell() {}
+
+    SharedSeqlockCell(const SharedSeqlockCell&) = delete;
+    SharedSeqlockCell& operator=(const SharedSeqlockCell&) = delete;
+
+    // false if the segment was created for another T
+    bool Init();
+
+    T Load() const noexcept { return m_segment->m_cell.load(); }
+    void Load(T* value) const noexcept { m_segment->m_cell.load(value); }
+    bool TryLoad(T* value) const noexcept {
+        return m_segment->m_cell.try_load(value);
+    }
+    void Store(const T& value) noexcept { m_segment->m_cell.store(value); }
+    template <class Func>
+    void Update(Func func) {
+        m_segment->m_cell.update(func);
+    }
+    uint64_t Version() const noexcept { return m_segment->m_cell.version(); }
+
+private:
+    struct Segment {
+        static constexpr uint64_t kMagic   = 0x434253514c4f434bull;  // CBSQLOCK
+        static constexpr uint32_t kVersion = 1;
+
+        union {
+            struct {
+                uint64_t m_magic;  // written last when the segment is created
+                uint32_t m_version;
+                uint32_t m_data_size;
+                uint64_t m_cell_size;
+            };
+            char m_reserved[64];
+        };
+        seqlock_cell<T> m_cell;
+    };
+
+private:
+    const std::string m_name;
+    const SharedMemory::Backing m_backing;
+    std::unique_ptr<SharedMemory> m_shared_memory;
+    Segment* m_segment;
+};
+
+template <class T>
+bool SharedSeqlockCell<T>::Init() {
+    m_shared_memory.reset(new SharedMemory(m_name, sizeof(Segment), m_backing));
+    Segment* segment = static_cast<Segment*>(m_shared_memory->Open());
+    if (segment == nullptr) return false;
+
+    if (__atomic_load_n(&segment->m_magic, __ATOMIC_ACQUIRE) !=
+        Segment::kMagic) {
+        // a fresh segment is all zero, anything else is a foreign layout
+        if (segment->m_cell_size != 0) return false;
+        new (&segment->m_cell) seqlock_cell<T>();
+        segment->m_version   = Segment::kVersion;
+        segment->m_data_size = sizeof(T);
+        segment->m_cell_size = sizeof(seqlock_cell<T>);
+        __atomic_store_n(&segment->m_magic, Segment::kMagic, __ATOMIC_RELEASE);
+    }
+
+    if (segment->m_version != Segment::kVersion ||
+        segment->m_data_size != sizeof(T) ||
+        segment->m_cell_size != sizeof(seqlock_cell<T>)) {
+        return false;
+    }
+    m_segment = segment;
+    return true;
+}
+
+}  // namespace cbase
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <tuple>
+#include <type_traits>
+#include <utility>
 
 template <int... N>
 struct sequence {};
@@ -34,9 +36,20 @@ void func_call(F&& f, std::tuple<Args...>&& args) {
                      sequence_t<sizeof...(Args)>{});
 }
 
-/*
-template <typename F, typename... Args>
-void func_call(F&& f, Args&&... args) {
-    (std::forward<F>(f))(std::forward<Args>(args)...);
+// Calls f with the elements of args and returns its result. Elements are
+// passed as lvalues for an lvalue tuple and moved out of an rvalue one.
+template <typename F, typename Tuple, int... N>
+auto tuple_apply_helper(F&& f, Tuple&& args, sequence<N...>)
+    -> decltype(std::forward<F>(f)(std::get<N>(std::forward<Tuple>(args))...)) {
+    return std::forward<F>(f)(std::get<N>(std::forward<Tuple>(args))...);
+}
+
+template <typename F, typename Tuple,
+          typename Seq = sequence_t<static_cast<int>(
+              std::tuple_size<typename std::decay<Tuple>::type>::value)>>
+auto tuple_apply(F&& f, Tuple&& args)
+    -> decltype(tuple_apply_helper(std::forward<F>(f),
+                                   std::forward<Tuple>(args), Seq{})) {
+    return tuple_apply_helper(std::forward<F>(f), std::forward<Tuple>(args),
+                              Seq{});
 }
-*/
@@ -0,0 +1,38 @@
+#include "shared_channel.h"
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+namespace cbase {
+
+namespace detail {
+
+int64_t ChannelNowNanos() noexcept {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// not FUTEX_PRIVATE_FLAG, the word lives in a mapping shared between
+// processes
+void FutexWait(uint32_t* addr, uint32_t expected, int64_t deadline_ns) {
+    struct timespec timeout;
+    struct timespec* timeout_ptr = nullptr;
+    if (deadline_ns >= 0) {
+        int64_t remain = deadline_ns - ChannelNowNanos();
+        if (remain <= 0) return;
+        timeout.tv_sec  = remain / 1000000000;
+        timeout.tv_nsec = remain % 1000000000;
+        timeout_ptr     = &timeout;
+    }
+    syscall(SYS_futex, addr, FUTEX_WAIT, expected, timeout_ptr, nullptr, 0);
+}
+
+void FutexWake(uint32_t* addr, int cnt) {
+    syscall(SYS_futex, addr, FUTEX_WAKE, cnt, nullptr, nullptr, 0);
+}
+
+}  // namespace detail
+
+}  // namespace cbase
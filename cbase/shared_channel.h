@@ -0,0 +1,434 @@
+#pragma once
+
+#include <signal.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "shared_lockfree_queue.h"
+#include "shared_memory.h"
+#include "utils.h"
+
+namespace cbase {
+
+// Request/response channel between processes on one host. Requests of
+// all clients go through one SharedLockFreeQueue, each client has its own
+// response queue, and responses are matched by correlation id. The server
+// creates the segments, clients attach to a free client slot:
+//
+//   "<name>.ctl"      control block, futex words and client slots
+//   "<name>.req"      requests
+//   "<name>.resp.<i>" responses of client i
+//
+// A waiting side spins first and then parks on a futex in the control
+// block, the other side only issues the wake syscall when someone parks.
+// Request and Response are copied through shared memory, so they must be
+// trivially copyable.
+
+enum class ChannelWait {
+    kSpin,          // never sleeps, lowest latency, burns a core
+    kPark,          // futex right away
+    kSpinThenPark,  // spin for m_spin_us, then futex
+};
+
+struct ChannelOptions {
+    uint32_t m_max_clients       = 64;
+    uint32_t m_request_capacity  = 4096;
+    uint32_t m_response_capacity = 256;
+    ChannelWait m_wait           = ChannelWait::kSpinThenPark;
+    uint32_t m_spin_us           = 50;
+};
+
+// who a request came from, pass it back to Reply
+struct ChannelContext {
+    uint32_t m_client_id;
+    uint64_t m_correlation_id;
+};
+
+template <class Payload>
+struct ChannelMessage {
+    uint64_t m_correlation_id;
+    uint32_t m_client_id;
+    uint32_t m_reserved;
+    Payload m_payload;
+};
+
+namespace detail {
+
+struct ChannelSlot {
+    int32_t m_owner_pid;  // 0 if free
+    uint32_t m_seq;       // futex word, bumped by a wake
+    uint32_t m_waiters;
+    uint32_t m_generation;  // bumped by every claim, high half of the ids
+    char m_padding[48];
+};
+
+struct ChannelControl {
+    uint64_t m_magic;
+    uint32_t m_version;  // written last, 0 until the server is ready
+    uint32_t m_max_clients;
+    uint32_t m_request_seq;
+    uint32_t m_request_waiters;
+    char m_padding[40];
+    ChannelSlot m_clients[0];
+};
+
+static_assert(sizeof(ChannelSlot) == 64, "slot is one cache line");
+static_assert(sizeof(ChannelControl) == 64, "control is one cache line");
+
+constexpr uint64_t kChannelMagic   = 0x4c4e484342424243ULL;  // CBBBCHNL
+constexpr uint32_t kChannelVersion = 2;
+
+int64_t ChannelNowNanos() noexcept;
+// FUTEX_WAIT on a shared mapping, deadline_ns of ChannelNowNanos, -1
+// waits forever
+void FutexWait(uint32_t* addr, uint32_t expected, int64_t deadline_ns);
+void FutexWake(uint32_t* addr, int cnt);
+
+// wakes the parked side of seq, costs a syscall only when one is parked
+inline void ChannelNotify(uint32_t* seq, uint32_t* waiters, int cnt) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiters, __ATOMIC_RELAXED) == 0) return;
+    __atomic_fetch_add(seq, 1, __ATOMIC_SEQ_CST);
+    FutexWake(seq, cnt);
+}
+
+// Calls try_once until it returns true or deadline_ns passes (-1 never).
+// A parked waiter announces itself in waiters and re-checks before it
+// sleeps, ChannelNotify either sees it or it sees the new data.
+template <class TryOnce>
+bool ChannelWaitFor(TryOnce try_once, uint32_t* seq, uint32_t* waiters,
+                    ChannelWait wait, uint32_t spin_us, int64_t deadline_ns) {
+    if (try_once()) return true;
+    int64_t now = ChannelNowNanos();
+    if (wait != ChannelWait::kPark) {
+        int64_t spin_end = now + static_cast<int64_t>(spin_us) * 1000;
+        if (wait == ChannelWait::kSpin) spin_end = deadline_ns;
+        while (true) {
+            for (int i = 0; i < 64; ++i) {
+                if (try_once()) return true;
+                cpu_relax();
+            }
+            now = ChannelNowNanos();
+            if (deadline_ns >= 0 && now >= deadline_ns) return false;
+            if (spin_end >= 0 && now >= spin_end) break;
+        }
+    }
+    while (deadline_ns < 0 || now < deadline_ns) {
+        uint32_t expected = __atomic_load_n(seq, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(waiters, 1, __ATOMIC_SEQ_CST);
+        bool ready = try_once();
+        if (!ready) FutexWait(seq, expected, deadline_ns);
+        __atomic_fetch_sub(waiters, 1, __ATOMIC_SEQ_CST);
+        if (ready || try_once()) return true;
+        now = ChannelNowNanos();
+    }
+    return false;
+}
+
+inline std::string ResponseQueueName(const std::string& name, uint32_t id) {
+    return name + ".resp." + std::to_string(id);
+}
+
+}  // namespace detail
+
+template <class Request, class Response>
+class SharedChannelServer {
+    static_assert(std::is_trivially_copyable<Request>::value,
+                  "Request must be trivially copyable");
+    static_assert(std::is_trivially_copyable<Response>::value,
+                  "Response must be trivially copyable");
+
+public:
+    using RequestMessage  = ChannelMessage<Request>;
+    using ResponseMessage = ChannelMessage<Response>;
+
+    // name must be a valid shm_open name, e.g. "/gateway"
+    SharedChannelServer(const std::string& name,
+                        const ChannelOptions& options = ChannelOptions())
+        : m_name(name), m_options(options), m_control(nullptr) {}
+    ~SharedChannelServer() {}
+
+    SharedChannelServer(const SharedChannelServer&) = delete;
+    SharedChannelServer& operator=(const SharedChannelServer&) = delete;
+
+    // creates the segments or reattaches to the ones of a previous run
+    bool Init();
+
+    // false if no request arrived within timeout_us, -1 waits forever.
+    // Several threads may receive from the same server.
+    bool Receive(Request* request, ChannelContext* context,
+                 int64_t timeout_us);
+
+    // -1 if the client's response queue is full or the id is invalid
+    int Reply(const ChannelContext& context, const Response& response);
+
+private:
+    const std::string m_name;
+    const ChannelOptions m_options;
+    std::unique_ptr<SharedMemory> m_control_memory;
+    detail::ChannelControl* m_control;
+    std::unique_ptr<SharedLockFreeQueue<RequestMessage>> m_requests;
+    std::vector<std::unique_ptr<SharedLockFreeQueue<ResponseMessage>>>
+        m_responses;
+};
+
+// One client per thread, a client owns a slot of the channel until it is
+// destroyed. Slots of dead processes are reclaimed by the next client.
+template <class Request, class Response>
+class SharedChannelClient {
+public:
+    using RequestMessage  = ChannelMessage<Request>;
+    using ResponseMessage = ChannelMessage<Response>;
+
+    SharedChannelClient(const std::string& name,
+                        const ChannelOptions& options = ChannelOptions())
+        : m_name(name),
+          m_options(options),
+          m_control(nullptr),
+          m_client_id(0),
+          m_has_slot(false),
+          m_next_id(0) {}
+    ~SharedChannelClient();
+
+    SharedChannelClient(const SharedChannelClient&) = delete;
+    SharedChannelClient& operator=(const SharedChannelClient&) = delete;
+
+    // false if the server is not up or every slot is taken
+    bool Init();
+
+    // 0 on success, -1 if the request queue is full, -2 on timeout.
+    // timeout_us of -1 waits forever.
+    int Call(const Request& request, Response* response, int64_t timeout_us) {
+        uint64_t id = Send(request);
+        if (id == 0) return -1;
+        return Wait(id, response, timeout_us);
+    }
+
+    // correlation id of the request, 0 if the request queue is full
+    uint64_t Send(const Request& request);
+    // waits for the response of id. Responses to later requests that
+    // arrive first are kept for their Wait, responses to earlier ones are
+    // dropped, so wait in the order of Send.
+    int Wait(uint64_t id, Response* response, int64_t timeout_us);
+
+    uint32_t ClientId() const noexcept { return m_client_id; }
+
+private:
+    // takes the kept response of id, drops the kept ones older than id
+    bool TakePending(uint64_t id, Response* response);
+
+private:
+    const std::string m_name;
+    const ChannelOptions m_options;
+    std::unique_ptr<SharedMemory> m_control_memory;
+    detail::ChannelControl* m_control;
+    uint32_t m_client_id;
+    bool m_has_slot;
+    uint64_t m_next_id;
+    std::unique_ptr<SharedLockFreeQueue<RequestMessage>> m_requests;
+    std::unique_ptr<SharedLockFreeQueue<ResponseMessage>> m_responses;
+    // responses that overtook the one being waited for, at most
+    // m_response_capacity
+    std::vector<ResponseMessage> m_pending;
+};
+
+template <class Request, class Response>
+bool SharedChannelServer<Request, Response>::Init() {
+    size_t control_size = sizeof(detail::ChannelControl) +
+                          sizeof(detail::ChannelSlot) * m_options.m_max_clients;
+    m_control_memory.reset(new SharedMemory(m_name + ".ctl", control_size));
+    m_control =
+        static_cast<detail::ChannelControl*>(m_control_memory->Open());
+    if (m_control == nullptr) return false;
+
+    m_requests.reset(new SharedLockFreeQueue<RequestMessage>(
+        m_options.m_request_capacity, m_name + ".req"));
+    if (!m_requests->Init()) return false;
+    for (uint32_t i = 0; i < m_options.m_max_clients; ++i) {
+        m_responses.emplace_back(new SharedLockFreeQueue<ResponseMessage>(
+            m_options.m_response_capacity,
+            detail::ResponseQueueName(m_name, i)));
+        if (!m_responses.back()->Init()) return false;
+    }
+
+    if (__atomic_load_n(&m_control->m_version, __ATOMIC_ACQUIRE) != 0) {
+        return m_control->m_magic == detail::kChannelMagic &&
+               m_control->m_version == detail::kChannelVersion &&
+               m_control->m_max_clients == m_options.m_max_clients;
+    }
+    m_control->m_magic       = detail::kChannelMagic;
+    m_control->m_max_clients = m_options.m_max_clients;
+    __atomic_store_n(&m_control->m_version, detail::kChannelVersion,
+                     __ATOMIC_RELEASE);
+    return true;
+}
+
+template <class Request, class Response>
+bool SharedChannelServer<Request, Response>::Receive(
+    Request* request, ChannelContext* context, int64_t timeout_us) {
+    RequestMessage message;
+    auto try_once = [&]() { return m_requests->GetData(&message) == 0; };
+    int64_t deadline =
+        timeout_us < 0 ? -1 : detail::ChannelNowNanos() + timeout_us * 1000;
+    if (!detail::ChannelWaitFor(try_once, &m_control->m_request_seq,
+                                &m_control->m_request_waiters,
+                                m_options.m_wait, m_options.m_spin_us,
+                                deadline)) {
+        return false;
+    }
+    *request                  = message.m_payload;
+    context->m_client_id      = message.m_client_id;
+    context->m_correlation_id = message.m_correlation_id;
+    return true;
+}
+
+template <class Request, class Response>
+int SharedChannelServer<Request, Response>::Reply(
+    const ChannelContext& context, const Response& response) {
+    if (context.m_client_id >= m_responses.size()) return -1;
+    ResponseMessage message;
+    message.m_correlation_id = context.m_correlation_id;
+    message.m_client_id      = context.m_client_id;
+    message.m_reserved       = 0;
+    message.m_payload        = response;
+    if (m_responses[context.m_client_id]->AddData(message) != 0) return -1;
+    detail::ChannelSlot& slot = m_control->m_clients[context.m_client_id];
+    detail::ChannelNotify(&slot.m_seq, &slot.m_waiters, INT32_MAX);
+    return 0;
+}
+
+template <class Request, class Response>
+SharedChannelClient<Request, Response>::~SharedChannelClient() {
+    if (!m_has_slot) return;
+    __atomic_store_n(&m_control->m_clients[m_client_id].m_owner_pid, 0,
+                     __ATOMIC_RELEASE);
+}
+
+template <class Request, class Response>
+bool SharedChannelClient<Request, Response>::Init() {
+    size_t control_size = sizeof(detail::ChannelControl) +
+                          sizeof(detail::ChannelSlot) * m_options.m_max_clients;
+    m_control_memory.reset(new SharedMemory(m_name + ".ctl", control_size));
+    // only the server creates segments, a client started before it must
+    // not leave an empty one behind
+    m_control =
+        static_cast<detail::ChannelControl*>(m_control_memory->Attach());
+    if (m_control == nullptr ||
+        __atomic_load_n(&m_control->m_version, __ATOMIC_ACQUIRE) !=
+            detail::kChannelVersion ||
+        m_control->m_max_clients != m_options.m_max_clients) {
+        return false;
+    }
+
+    int32_t pid = static_cast<int32_t>(getpid());
+    for (uint32_t i = 0; i < m_options.m_max_clients && !m_has_slot; ++i) {
+        int32_t* owner  = &m_control->m_clients[i].m_owner_pid;
+        int32_t current = __atomic_load_n(owner, __ATOMIC_ACQUIRE);
+        // a slot whose owner is gone is free again
+        if (current != 0 && kill(current, 0) != 0 && errno == ESRCH) {
+            __atomic_compare_exchange_n(owner, &current, 0, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+            current = 0;
+        }
+        if (current == 0 &&
+            __atomic_compare_exchange_n(owner, &current, pid, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            m_client_id = i;
+            m_has_slot  = true;
+        }
+    }
+    if (!m_has_slot) return false;
+
+    m_requests.reset(new SharedLockFreeQueue<RequestMessage>(
+        m_options.m_request_capacity, m_name + ".req"));
+    m_responses.reset(new SharedLockFreeQueue<ResponseMessage>(
+        m_options.m_response_capacity,
+        detail::ResponseQueueName(m_name, m_client_id)));
+    if (!m_requests->Init() || !m_responses->Init()) return false;
+
+    // drop what was left for the previous owner of the slot
+    ResponseMessage stale;
+    while (m_responses->GetData(&stale) == 0) {
+    }
+    // ids grow across owners of the slot, so a response left for a
+    // previous owner is always below ours
+    uint32_t generation = __atomic_add_fetch(
+        &m_control->m_clients[m_client_id].m_generation, 1, __ATOMIC_RELAXED);
+    m_next_id = (static_cast<uint64_t>(generation) << 32) + 1;
+    return true;
+}
+
+template <class Request, class Response>
+uint64_t SharedChannelClient<Request, Response>::Send(
+    const Request& request) {
+    RequestMessage message;
+    message.m_correlation_id = m_next_id;
+    message.m_client_id      = m_client_id;
+    message.m_reserved       = 0;
+    message.m_payload        = request;
+    if (m_requests->AddData(message) != 0) return 0;
+    detail::ChannelNotify(&m_control->m_request_seq,
+                          &m_control->m_request_waiters, 1);
+    return m_next_id++;
+}
+
+template <class Request, class Response>
+int SharedChannelClient<Request, Response>::Wait(uint64_t id,
+                                                 Response* response,
+                                                 int64_t timeout_us) {
+    if (TakePending(id, response)) return 0;
+
+    bool matched = false;
+    auto try_once = [&]() {
+        ResponseMessage message;
+        while (m_responses->GetData(&message) == 0) {
+            uint64_t got = message.m_correlation_id;
+            if (got == id) {
+                *response = message.m_payload;
+                matched   = true;
+                return true;
+            }
+            // a later request of this slot owner, answered out of order by
+            // another server thread or pipelined by the caller
+            if (got > id && got < m_next_id) {
+                if (m_pending.size() >= m_options.m_response_capacity) {
+                    m_pending.erase(m_pending.begin());
+                }
+                m_pending.push_back(message);
+            }
+            // anything else answers a Wait that timed out or a previous
+            // owner of the slot
+        }
+        return false;
+    };
+    int64_t deadline =
+        timeout_us < 0 ? -1 : detail::ChannelNowNanos() + timeout_us * 1000;
+    detail::ChannelSlot& slot = m_control->m_clients[m_client_id];
+    detail::ChannelWaitFor(try_once, &slot.m_seq, &slot.m_waiters,
+                           m_options.m_wait, m_options.m_spin_us, deadline);
+    return matched ? 0 : -2;
+}
+
+template <class Request, class Response>
+bool SharedChannelClient<Request, Response>::TakePending(uint64_t id,
+                                                         Response* response) {
+    bool found  = false;
+    size_t kept = 0;
+    for (size_t i = 0; i < m_pending.size(); ++i) {
+        uint64_t got = m_pending[i].m_correlation_id;
+        if (got == id) {
+            *response = m_pending[i].m_payload;
+            found     = true;
+        } else if (got > id) {
+            m_pending[kept++] = m_pending[i];
+        }
+    }
+    m_pending.resize(kept);
+    return found;
+}
+
+}  // namespace cbase
@@ -0,0 +1,101 @@
+// Ping-pong round trip over the shared channel between two processes, one
+// client and one server, for each wait mode.
+// g++ -std=c++11 -O2 shared_channel_bench.cpp shared_channel.cpp
+//     shared_memory.cpp latency_histogram.cpp thread_index.cpp -lrt
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "latency_histogram.h"
+#include "shared_channel.h"
+
+struct Ping {
+    uint64_t m_seq;
+    char m_body[48];
+};
+
+struct Pong {
+    uint64_t m_seq;
+};
+
+static void Unlink(const std::string& name, uint32_t max_clients) {
+    shm_unlink((name + ".ctl").c_str());
+    shm_unlink((name + ".req").c_str());
+    for (uint32_t i = 0; i < max_clients; ++i) {
+        shm_unlink(cbase::detail::ResponseQueueName(name, i).c_str());
+    }
+}
+
+static void Serve(const std::string& name,
+                  const cbase::ChannelOptions& options, int loops) {
+    cbase::SharedChannelServer<Ping, Pong> server(name, options);
+    if (!server.Init()) _exit(1);
+    Ping ping;
+    cbase::ChannelContext context;
+    for (int i = 0; i < loops; ++i) {
+        if (!server.Receive(&ping, &context, 5000000)) _exit(2);
+        Pong pong;
+        pong.m_seq = ping.m_seq;
+        server.Reply(context, pong);
+    }
+    _exit(0);
+}
+
+static void Bench(const char* label, cbase::ChannelWait wait, int loops) {
+    const std::string name = "/cbase_channel_bench";
+    cbase::ChannelOptions options;
+    options.m_max_clients = 4;
+    options.m_wait        = wait;
+    Unlink(name, options.m_max_clients);
+
+    // the server has to create the segments before the client attaches
+    cbase::SharedChannelServer<Ping, Pong> creator(name, options);
+    if (!creator.Init()) {
+        printf("server init failed\n");
+        return;
+    }
+    pid_t pid = fork();
+    if (pid == 0) Serve(name, options, loops);
+
+    cbase::SharedChannelClient<Ping, Pong> client(name, options);
+    if (!client.Init()) {
+        printf("client init failed\n");
+        return;
+    }
+    cbase::Histogram histogram;
+    Ping ping;
+    Pong pong;
+    int failed = 0;
+    for (int i = 0; i < loops; ++i) {
+        ping.m_seq      = i;
+        int64_t start   = cbase::detail::ChannelNowNanos();
+        int ret         = client.Call(ping, &pong, 1000000);
+        int64_t elapsed = cbase::detail::ChannelNowNanos() - start;
+        if (ret != 0 || pong.m_seq != ping.m_seq) {
+            ++failed;
+            continue;
+        }
+        histogram.Record(static_cast<uint64_t>(elapsed));
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    printf("%-16s rtt ns  p50 %6llu  p99 %7llu  p99.9 %8llu  mean %8.0f"
+           "  failed %d\n",
+           label,
+           static_cast<unsigned long long>(histogram.Percentile(50)),  // NOLINT
+           static_cast<unsigned long long>(histogram.Percentile(99)),  // NOLINT
+           static_cast<unsigned long long>(                            // NOLINT
+               histogram.Percentile(99.9)),
+           histogram.Mean(), failed);
+    Unlink(name, options.m_max_clients);
+}
+
+int main(int argc, char** argv) {
+    int loops = argc > 1 ? atoi(argv[1]) : 200000;
+    Bench("spin", cbase::ChannelWait::kSpin, loops);
+    Bench("spin_then_park", cbase::ChannelWait::kSpinThenPark, loops);
+    Bench("park", cbase::ChannelWait::kPark, loops);
+    return 0;
+}
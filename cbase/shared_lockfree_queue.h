@@ -1,6 +1,9 @@
 #pragma once
 
+#include <signal.h>
+#include <unistd.h>
 #include <cassert>
+#include <cerrno>
 #include <chrono>  // NOLINT
 #include <cstdint>
 #include <memory>
@@ -12,23 +15,56 @@
 
 namespace cbase {
 
+// Bounded MPMC queue in shared memory, Data must be trivially copyable.
+//
+// With Backing::kFile the queue lives in a regular file and survives a
+// reboot. Checkpoint() flushes the blocks and then records the readable
+// range [head, tail) in the header. A reattach within the same boot
+// continues from the live head and tail, the page cache still holds every
+// write. After a reboot the queue restarts from the last checkpoint, a
+// message is lost only if produced after it and replayed only if consumed
+// after it. Producers never overwrite a block of the checkpointed range,
+// so the queue reports full until the consumed part is checkpointed; call
+// MaybeCheckpoint() regularly, e.g. from the consumer loop.
 template <class Data>
 class SharedLockFreeQueue {
 public:
-    SharedLockFreeQueue(size_t max_cnt, const std::string& name)
+    SharedLockFreeQueue(
+        size_t max_cnt, const std::string& name,
+        SharedMemory::Backing backing = SharedMemory::Backing::kShm)
         : m_max_cnt(max_cnt),
           m_name(name),
+          m_backing(backing),
           m_shared_memory(nullptr),
           m_queue(nullptr),
-          m_blocks(nullptr) {}
-    ~SharedLockFreeQueue() {}
+          m_blocks(nullptr),
+          m_pid(0) {}
+    // a file backed queue is checkpointed one last time
+    ~SharedLockFreeQueue() {
+        if (m_queue != nullptr) Checkpoint();
+    }
 
+    // false if the segment or file holds another layout or was created
+    // with different max_cnt or Data
     bool Init();
 
+    // -1 if full, -2 if a block was given up by its reader before the
+    // data got in, see GetData
     int AddData(const Data& data);
     int AddData(const std::vector<Data>& datas);
+    // -1 if empty, -2 if the next message did not arrive within half a
+    // second. If its producer is stuck or died the message is dropped,
+    // if the reader of the block's previous round still holds the block
+    // nothing is consumed.
     int GetData(Data* data);
 
+    // file backed only: makes everything produced and consumed so far
+    // durable, blocks on the disk. false for shm queues or on io error.
+    bool Checkpoint();
+    // Checkpoint() if the last one, from any process, is at least
+    // interval_ms old. Cheap when it is not due.
+    bool MaybeCheckpoint(uint32_t interval_ms);
+
     uint64_t GetIdx(uint64_t idx) const noexcept { return idx % m_max_cnt; }
 
     uint64_t UsedCnt(uint64_t head, uint64_t tail) const noexcept {
@@ -37,86 +73,312 @@ public:
     }
 
 private:
+    // a writer or reader waits this long for the other side of its block
+    static constexpr int kWaitSpins    = 1 << 14;
+    static constexpr int kWaitRetries  = 5;
+    static constexpr int kRetrySleepMs = 100;
+
+    // A block is for one position at a time. Its word holds the low bits
+    // of the position, the state and the pid of the process holding it, so
+    // every hand over is a single CAS. The producer of pos claims it once
+    // the reader of pos - max_cnt released it, the reader of pos claims it
+    // before moving the head and releases it for pos + max_cnt. A block
+    // held by a dead process is reclaimed by whoever waits for it.
     struct Block {
+        enum : uint8_t {
+            kFree      = 0,
+            kWritten   = 1,
+            kWriting   = 2,  // held by its producer
+            kAbandoned = 3,  // its reader gave up while it was being written
+            kReading   = 4,  // held by its reader
+        };
+
         union {
-            struct {
-                uint8_t m_write_fin;
-            };
+            uint64_t m_word;  // seq | state << 32 | pid << 40
             char m_reserved[8];
         };
         Data m_data;
 
-        bool IsReadable() const noexcept {
-            return __atomic_load_n(&m_write_fin, __ATOMIC_ACQUIRE) == 1;
+        // pid_max is at most 2^22, a pid fits in the 24 bits left
+        static constexpr uint64_t Word(uint64_t pos, uint8_t state,
+                                       pid_t pid = 0) noexcept {
+            return static_cast<uint32_t>(pos) |
+                   static_cast<uint64_t>(state) << 32 |
+                   static_cast<uint64_t>(pid) << 40;
+        }
+        static uint32_t SeqOf(uint64_t word) noexcept {
+            return static_cast<uint32_t>(word);
+        }
+        static uint8_t StateOf(uint64_t word) noexcept {
+            return static_cast<uint8_t>(word >> 32);
+        }
+        static pid_t PidOf(uint64_t word) noexcept {
+            return static_cast<pid_t>(word >> 40);
+        }
+        // > 0 if the block moved past pos, < 0 if it is still before it
+        static int32_t Distance(uint64_t word, uint64_t pos) noexcept {
+            return static_cast<int32_t>(SeqOf(word) -
+                                        static_cast<uint32_t>(pos));
         }
-        void SetData(const Data& data) {
-            m_data = data;
-            __atomic_store_n(&m_write_fin, 1, __ATOMIC_RELEASE);
+        // a reader has pos, or pos was given up
+        static bool IsTaken(uint64_t word, uint64_t pos) noexcept {
+            int32_t distance = Distance(word, pos);
+            return distance > 0 ||
+                   (distance == 0 && (StateOf(word) == kReading ||
+                                      StateOf(word) == kAbandoned));
         }
 
-        Data GetData() noexcept {
-            __atomic_store_n(&m_write_fin, 0, __ATOMIC_RELEASE);
-            return m_data;
+        uint64_t Load() const noexcept {
+            return __atomic_load_n(&m_word, __ATOMIC_ACQUIRE);
+        }
+        bool IsWritten(uint64_t pos) const noexcept {
+            return Load() == Word(pos, kWritten);
+        }
+        bool Cas(uint64_t from, uint64_t to) noexcept {
+            return __atomic_compare_exchange_n(&m_word, &from, to, false,
+                                               __ATOMIC_ACQ_REL,
+                                               __ATOMIC_ACQUIRE);
+        }
+        // hands the block to the producer of next
+        void Release(uint64_t next) noexcept {
+            __atomic_store_n(&m_word, Word(next, kFree), __ATOMIC_RELEASE);
         }
     };
 
     struct Queue {
+        static constexpr uint64_t kMagic   = 0x434253484d515545ull;  // CBSHMQUE
+        static constexpr uint32_t kVersion = 3;
+
         union {
             struct {
                 uint64_t m_mem_size;
                 uint64_t m_max_cnt;
                 uint64_t m_head;
                 uint64_t m_tail;
+                uint64_t m_magic;  // written last when initialized
+                uint32_t m_version;
+                uint32_t m_block_size;
+                // SharedMemory::BootId() the live head and tail belong to
+                uint64_t m_boot_id;
+                // range that was readable and on disk at the last checkpoint
+                uint64_t m_checkpoint_head;
+                uint64_t m_checkpoint_tail;
+                int64_t m_checkpoint_nanos;  // steady clock of that boot
+                // boot id << 32 | pid of the process checkpointing, 0 if none
+                uint64_t m_checkpoint_owner;
             };
-            char m_reserved[32];
+            char m_reserved[128];
         };
         Block m_blocks[0];
     };
 
+    bool IsDurable() const noexcept {
+        return m_backing == SharedMemory::Backing::kFile;
+    }
+    // producers may not go past the checkpointed head of a durable queue
+    uint64_t ReusableHead() const noexcept {
+        return __atomic_load_n(IsDurable() ? &m_queue->m_checkpoint_head
+                                           : &m_queue->m_head,
+                               __ATOMIC_RELAXED);
+    }
+
+    // spins, then sleeps between checks, false if ready() never held
+    template <class Ready>
+    static bool WaitFor(Ready ready);
+    // 0, or -2 if the reader of pos gave up on it before it was written
+    int SetData(const Data& data, uint64_t pos);
+    // the reader of pos gives up on its producer, false if the block is
+    // not at pos or changed meanwhile
+    bool Abandon(Block* block, uint64_t pos);
+    // hands a block still held for a round before pos by a dead process
+    // over to pos, true if it did
+    bool Reclaim(Block* block, uint64_t pos);
+    void AdvanceHead(uint64_t head) noexcept {
+        __atomic_compare_exchange_n(&m_queue->m_head, &head, head + 1, false,
+                                    __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    }
+
+    void LockCheckpoint();
+    void UnlockCheckpoint();
+    // restarts a durable queue from its checkpoint after a reboot
+    void Recover(uint64_t boot_id);
+
+    static int64_t NowNanos() noexcept {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
 private:
     const size_t m_max_cnt;
     const std::string m_name;
+    const SharedMemory::Backing m_backing;
     std::unique_ptr<SharedMemory> m_shared_memory;
     Queue* m_queue;
     Block* m_blocks;
+    pid_t m_pid;  // owner of the blocks this process holds
 };
 
+template <class Data>
+constexpr int SharedLockFreeQueue<Data>::kRetrySleepMs;
+
 template <class Data>
 bool SharedLockFreeQueue<Data>::Init() {
     size_t total_size = sizeof(Queue) + sizeof(Block) * m_max_cnt;
-    m_shared_memory.reset(new SharedMemory(m_name, total_size));
-    m_queue  = reinterpret_cast<Queue*>(m_shared_memory->Open());
+    m_shared_memory.reset(new SharedMemory(m_name, total_size, m_backing));
+    m_queue = reinterpret_cast<Queue*>(m_shared_memory->Open());
+    if (m_queue == nullptr) return false;
     m_blocks = m_queue->m_blocks;
+    m_pid    = getpid();
 
-    if (m_queue->m_mem_size == 0) {
-        m_queue->m_mem_size = static_cast<uint64_t>(total_size);
-        m_queue->m_max_cnt  = m_max_cnt;
-        m_queue->m_head     = 0;
-        m_queue->m_tail     = 0;
+    uint64_t boot_id = SharedMemory::BootId();
+    if (__atomic_load_n(&m_queue->m_magic, __ATOMIC_ACQUIRE) != Queue::kMagic) {
+        // a fresh segment is all zero, anything else is a foreign layout
+        if (m_queue->m_mem_size != 0) {
+            m_queue = nullptr;
+            return false;
+        }
+        m_queue->m_mem_size         = static_cast<uint64_t>(total_size);
+        m_queue->m_max_cnt          = m_max_cnt;
+        m_queue->m_head             = 0;
+        m_queue->m_tail             = 0;
+        m_queue->m_version          = Queue::kVersion;
+        m_queue->m_block_size       = sizeof(Block);
+        m_queue->m_boot_id          = boot_id;
+        m_queue->m_checkpoint_head  = 0;
+        m_queue->m_checkpoint_tail  = 0;
+        m_queue->m_checkpoint_nanos = 0;
+        m_queue->m_checkpoint_owner = 0;
+        for (uint64_t i = 0; i < m_max_cnt; ++i) {
+            m_blocks[i].m_word = Block::Word(i, Block::kFree);
+        }
+        __atomic_store_n(&m_queue->m_magic, Queue::kMagic, __ATOMIC_RELEASE);
     }
 
-    assert(m_queue->m_mem_size == static_cast<uint64_t>(total_size) &&
-           "unexpect total size.");
-    assert(m_queue->m_max_cnt == m_max_cnt && "unexpect max cnt.");
+    if (m_queue->m_version != Queue::kVersion ||
+        m_queue->m_mem_size != static_cast<uint64_t>(total_size) ||
+        m_queue->m_max_cnt != m_max_cnt ||
+        m_queue->m_block_size != sizeof(Block)) {
+        m_queue = nullptr;
+        return false;
+    }
+
+    // same boot: the page cache kept every write, live head/tail are right
+    if (IsDurable() &&
+        __atomic_load_n(&m_queue->m_boot_id, __ATOMIC_ACQUIRE) != boot_id) {
+        Recover(boot_id);
+    }
     return true;
 }
 
+template <class Data>
+void SharedLockFreeQueue<Data>::Recover(uint64_t boot_id) {
+    LockCheckpoint();
+    // another process may have recovered while we waited for the lock
+    if (__atomic_load_n(&m_queue->m_boot_id, __ATOMIC_ACQUIRE) != boot_id) {
+        uint64_t head = m_queue->m_checkpoint_head;
+        uint64_t end  = m_queue->m_checkpoint_tail;
+        if (end < head || end - head > m_max_cnt) end = head;
+
+        // the block states on disk are whatever was flushed last. The data
+        // of [head, end) was synced before the checkpoint and no producer
+        // writes there, so rebuild the states from the checkpoint alone.
+        for (uint64_t pos = head; pos < head + m_max_cnt; ++pos) {
+            m_blocks[GetIdx(pos)].m_word =
+                Block::Word(pos, pos < end ? Block::kWritten : Block::kFree);
+        }
+
+        m_queue->m_head             = head;
+        m_queue->m_tail             = end;
+        m_queue->m_checkpoint_tail  = end;
+        m_queue->m_checkpoint_nanos = 0;
+        __atomic_store_n(&m_queue->m_boot_id, boot_id, __ATOMIC_RELEASE);
+        m_shared_memory->Sync();
+    }
+    UnlockCheckpoint();
+}
+
+template <class Data>
+void SharedLockFreeQueue<Data>::LockCheckpoint() {
+    uint64_t boot_id = SharedMemory::BootId();
+    uint64_t owner   = boot_id << 32 | static_cast<uint32_t>(getpid());
+    uint64_t current = 0;
+    while (!__atomic_compare_exchange_n(&m_queue->m_checkpoint_owner, &current,
+                                        owner, false, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED)) {
+        // an owner from an earlier boot or a dead process is stale
+        pid_t pid = static_cast<pid_t>(current & 0xffffffffu);
+        if (current != 0 && ((current >> 32) != (boot_id & 0xffffffffu) ||
+                             (kill(pid, 0) != 0 && errno == ESRCH))) {
+            continue;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        current = 0;
+    }
+}
+
+template <class Data>
+void SharedLockFreeQueue<Data>::UnlockCheckpoint() {
+    __atomic_store_n(&m_queue->m_checkpoint_owner, 0, __ATOMIC_RELEASE);
+}
+
+template <class Data>
+bool SharedLockFreeQueue<Data>::Checkpoint() {
+    if (!IsDurable() || m_queue == nullptr) return false;
+    LockCheckpoint();
+    uint64_t head = __atomic_load_n(&m_queue->m_head, __ATOMIC_ACQUIRE);
+    uint64_t tail = __atomic_load_n(&m_queue->m_tail, __ATOMIC_ACQUIRE);
+    // only a prefix of fully written blocks is durable, a producer may
+    // still be copying into a claimed one
+    uint64_t committed = m_queue->m_checkpoint_tail;
+    if (committed < head) committed = head;
+    while (committed < tail &&
+           m_blocks[GetIdx(committed)].IsWritten(committed)) {
+        ++committed;
+    }
+
+    // blocks first, the header must never point at data not on disk yet
+    bool ok = m_shared_memory->Sync(sizeof(Queue));
+    if (ok) {
+        m_queue->m_checkpoint_tail = committed;
+        __atomic_store_n(&m_queue->m_checkpoint_head, head, __ATOMIC_RELAXED);
+        ok = m_shared_memory->Sync(0, sizeof(Queue));
+    }
+    __atomic_store_n(&m_queue->m_checkpoint_nanos, NowNanos(),
+                     __ATOMIC_RELAXED);
+    UnlockCheckpoint();
+    return ok;
+}
+
+template <class Data>
+bool SharedLockFreeQueue<Data>::MaybeCheckpoint(uint32_t interval_ms) {
+    if (!IsDurable() || m_queue == nullptr) return false;
+    int64_t now  = NowNanos();
+    int64_t last = __atomic_load_n(&m_queue->m_checkpoint_nanos,
+                                   __ATOMIC_RELAXED);
+    if (now - last < static_cast<int64_t>(interval_ms) * 1000000) return false;
+    // whoever moves the stamp does the checkpoint
+    if (!__atomic_compare_exchange_n(&m_queue->m_checkpoint_nanos, &last, now,
+                                     false, __ATOMIC_RELAXED,
+                                     __ATOMIC_RELAXED)) {
+        return false;
+    }
+    return Checkpoint();
+}
+
 template <class Data>
 int SharedLockFreeQueue<Data>::AddData(const Data& data) {
     uint64_t new_tail = 0;
     do {
         // RELAXED is enough
         new_tail      = __atomic_load_n(&(m_queue->m_tail), __ATOMIC_RELAXED);
-        uint64_t head = __atomic_load_n(&(m_queue->m_head), __ATOMIC_RELAXED);
+        uint64_t head     = ReusableHead();
         uint64_t used_cnt = UsedCnt(head, new_tail);
-        if (RSUnLikely(used_cnt + 1 > m_queue->m_max_cnt)) return -1;
+        if (unlikely(used_cnt + 1 > m_queue->m_max_cnt)) return -1;
     } while (!__atomic_compare_exchange_n(&(m_queue->m_tail), &new_tail,
                                           new_tail + 1, true, __ATOMIC_RELEASE,
                                           __ATOMIC_RELAXED));
-    new_tail     = GetIdx(new_tail);
-    Block* block = &(m_blocks[new_tail]);
-    block->SetData(data);
-    return 0;
+    return SetData(data, new_tail);
 }
 
 template <class Data>
@@ -127,54 +389,128 @@ int SharedLockFreeQueue<Data>::AddData(const std::vector<Data>& datas) {
     do {
         // RELAXED is enough
         new_tail      = __atomic_load_n(&(m_queue->m_tail), __ATOMIC_RELAXED);
-        uint64_t head = __atomic_load_n(&(m_queue->m_head), __ATOMIC_RELAXED);
+        uint64_t head     = ReusableHead();
         uint64_t used_cnt = UsedCnt(head, new_tail);
-        if (RSUnLikely(used_cnt + cnt > m_queue->m_max_cnt)) return -1;
+        if (unlikely(used_cnt + cnt > m_queue->m_max_cnt)) return -1;
     } while (!__atomic_compare_exchange_n(&(m_queue->m_tail), &new_tail,
                                           new_tail + cnt, true,
                                           __ATOMIC_RELEASE, __ATOMIC_RELAXED));
     // new_tail 对应的idx就是用来放data
-    new_tail = GetIdx(new_tail);
+    int ret = 0;
     for (uint64_t i = 0; i < cnt; ++i) {
-        Block* block = &(m_blocks[new_tail + i]);
-        block->SetData(datas[i]);
+        if (SetData(datas[i], new_tail + i) != 0) ret = -2;
+    }
+    return ret;
+}
+
+template <class Data>
+int SharedLockFreeQueue<Data>::SetData(const Data& data, uint64_t pos) {
+    Block* block = &(m_blocks[GetIdx(pos)]);
+    uint64_t writing = Block::Word(pos, Block::kWriting, m_pid);
+    bool skipped     = false;
+    auto claim       = [&]() {
+        skipped = Block::Distance(block->Load(), pos) > 0;
+        return skipped || block->Cas(Block::Word(pos, Block::kFree), writing);
+    };
+    // the reader of the previous round may still be copying out, or have
+    // died holding the block
+    while (!WaitFor(claim)) {
+        if (!Reclaim(block, pos)) return -2;
+    }
+    if (skipped) return -2;
+
+    block->m_data = data;
+    if (!block->Cas(writing, Block::Word(pos, Block::kWritten))) {
+        // abandoned meanwhile, nobody reads this round
+        block->Release(pos + m_max_cnt);
+        return -2;
     }
     return 0;
 }
 
 template <class Data>
 int SharedLockFreeQueue<Data>::GetData(Data* data) {
-    uint64_t new_head = 0;
-    do {
-        new_head      = __atomic_load_n(&(m_queue->m_head), __ATOMIC_RELAXED);
+    for (;;) {
+        uint64_t head = __atomic_load_n(&(m_queue->m_head), __ATOMIC_ACQUIRE);
         uint64_t tail = __atomic_load_n(&(m_queue->m_tail), __ATOMIC_RELAXED);
-        uint64_t used_cnt = UsedCnt(new_head, tail);
-        if (used_cnt == 0) return -1;
-    } while (!__atomic_compare_exchange_n(&(m_queue->m_head), &new_head,
-                                          new_head + 1, true, __ATOMIC_RELEASE,
-                                          __ATOMIC_RELAXED));
-    // new_head 对应的idx就是可以返回的data
-    new_head     = GetIdx(new_head);
-    Block* block = &(m_blocks[new_head]);
-
-    // TODO(adaiboy): when write process failed when store write fin
-    // then read process will block forever, so try drop it
-    int retry_cnt = 0;
-    while (retry_cnt < 5) {
-        if (!block->IsReadable()) {
-            ++retry_cnt;
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-        } else {
-            break;
-        }
-    }
-    if (retry_cnt >= 5) {
-        block->GetData();
-        return -2;
-    } else {
-        *data = block->GetData();
+        if (UsedCnt(head, tail) == 0) return -1;
+
+        // head 对应的idx就是可以返回的data
+        Block* block     = &(m_blocks[GetIdx(head)]);
+        uint64_t written = Block::Word(head, Block::kWritten);
+        // the writer usually finishes within a few hundred cycles
+        bool ready = WaitFor([&]() {
+            uint64_t word = block->Load();
+            return word == written || Block::IsTaken(word, head) ||
+                   __atomic_load_n(&(m_queue->m_head), __ATOMIC_RELAXED) !=
+                       head;
+        });
+        if (block->Cas(written, Block::Word(head, Block::kReading, m_pid))) {
+            AdvanceHead(head);
+            *data = block->m_data;
+            block->Release(head + m_max_cnt);
+            return 0;
+        }
+        // another reader has it but may not have moved the head yet
+        if (Block::IsTaken(block->Load(), head)) {
+            AdvanceHead(head);
+            continue;
+        }
+        if (ready || Reclaim(block, head)) continue;
+        // a producer process may have died before it finished
+        if (Abandon(block, head)) {
+            AdvanceHead(head);
+            return -2;
+        }
+        // still held for the previous round by a live process
+        if (Block::Distance(block->Load(), head) < 0) return -2;
     }
-    return 0;
+}
+
+template <class Data>
+bool SharedLockFreeQueue<Data>::Abandon(Block* block, uint64_t pos) {
+    uint64_t word = block->Load();
+    if (Block::Distance(word, pos) != 0) return false;
+    switch (Block::StateOf(word)) {
+    case Block::kFree:
+        // not claimed yet, a late producer of pos sees it moved on
+        return block->Cas(word, Block::Word(pos + m_max_cnt, Block::kFree));
+    case Block::kWriting:
+        // the producer releases it when done, or its successor reclaims it
+        // if the producer died
+        return block->Cas(word, Block::Word(pos, Block::kAbandoned,
+                                            Block::PidOf(word)));
+    default:
+        return false;
+    }
+}
+
+template <class Data>
+bool SharedLockFreeQueue<Data>::Reclaim(Block* block, uint64_t pos) {
+    uint64_t word = block->Load();
+    uint8_t state = Block::StateOf(word);
+    if (Block::Distance(word, pos) >= 0 || state == Block::kFree ||
+        state == Block::kWritten) {
+        return false;
+    }
+    // the rounds in between are lost, their producers and readers see the
+    // block moved past them
+    if (kill(Block::PidOf(word), 0) == 0 || errno != ESRCH) return false;
+    return block->Cas(word, Block::Word(pos, Block::kFree));
+}
+
+template <class Data>
+template <class Ready>
+bool SharedLockFreeQueue<Data>::WaitFor(Ready ready) {
+    for (int spin = 0; spin < kWaitSpins; ++spin) {
+        if (ready()) return true;
+        cpu_relax();
+    }
+    for (int retry = 0; retry < kWaitRetries; ++retry) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(kRetrySleepMs));
+        if (ready()) return true;
+    }
+    return false;
 }
 
 }  // namespace cbase
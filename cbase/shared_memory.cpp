@@ -9,31 +9,101 @@
 
 namespace cbase {
 
-SharedMemory::SharedMemory(const std::string& name, size_t mem_size)
-    : m_fd(-1), m_name(name), m_mem_size(mem_size), m_addr(nullptr) {}
+SharedMemory::SharedMemory(const std::string& name, size_t mem_size,
+                           Backing backing)
+    : m_fd(-1),
+      m_name(name),
+      m_mem_size(mem_size),
+      m_backing(backing),
+      m_addr(nullptr) {}
 
-SharedMemory::~SharedMemory() {}
+SharedMemory::~SharedMemory() {
+    if (m_addr != nullptr) munmap(m_addr, m_mem_size);
+    if (m_fd >= 0) close(m_fd);
+}
+
+int SharedMemory::OpenFd(int flags, int mode) const {
+    if (m_backing == Backing::kFile) {
+        return open(m_name.c_str(), flags | O_CLOEXEC, mode);
+    }
+    return shm_open(m_name.c_str(), flags, mode);
+}
 
 void* SharedMemory::Open() {
     if (m_fd > 0 && m_addr != nullptr) return m_addr;
 
-    m_fd = shm_open(m_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0666);
+    m_fd = OpenFd(O_RDWR | O_CREAT | O_EXCL, 0666);
     if (m_fd < 0) {
-        m_fd     = shm_open(m_name.c_str(), O_RDWR, 0666);
-        auto ret = fstat(m_fd, &m_stat);
-        assert(ret == 0 && "get stat of file failed");
-    } else {
-        auto ret = ftruncate(m_fd, m_mem_size);
-        assert(ret == 0 && "set size of shared memory failed.");
-        ret = fstat(m_fd, &m_stat);
-        assert(ret == 0 && "get stat of file failed");
-    }
-    assert(m_fd > 0 && "shm open on file failed.");
-    assert(m_mem_size == static_cast<size_t>(m_stat.st_size) &&
-           "shm size unexpected.");
-    m_addr =
+        m_fd = OpenFd(O_RDWR, 0666);
+        if (m_fd < 0) return nullptr;
+    } else if (ftruncate(m_fd, m_mem_size) != 0) {
+        close(m_fd);
+        m_fd = -1;
+        return nullptr;
+    }
+    // a file left by a build with another layout is not ours to resize
+    if (fstat(m_fd, &m_stat) != 0 ||
+        m_mem_size != static_cast<size_t>(m_stat.st_size)) {
+        close(m_fd);
+        m_fd = -1;
+        return nullptr;
+    }
+    void* addr =
+        mmap(nullptr, m_mem_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    assert(addr != MAP_FAILED && "mmap fd failed.");
+    if (addr == MAP_FAILED) {
+        close(m_fd);
+        m_fd = -1;
+        return nullptr;
+    }
+    m_addr = addr;
+    return m_addr;
+}
+
+void* SharedMemory::Attach() {
+    if (m_fd > 0 && m_addr != nullptr) return m_addr;
+
+    m_fd = OpenFd(O_RDWR, 0);
+    if (m_fd < 0) return nullptr;
+    if (fstat(m_fd, &m_stat) != 0 ||
+        m_mem_size != static_cast<size_t>(m_stat.st_size)) {
+        close(m_fd);
+        m_fd = -1;
+        return nullptr;
+    }
+    void* addr =
         mmap(nullptr, m_mem_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
-    assert(m_addr != MAP_FAILED && "mmap fd failed.");
+    if (addr == MAP_FAILED) {
+        close(m_fd);
+        m_fd = -1;
+        return nullptr;
+    }
+    m_addr = addr;
+    return m_addr;
+}
+
+const void* SharedMemory::OpenReadOnly() {
+    if (m_fd > 0 && m_addr != nullptr) return m_addr;
+
+    m_fd = OpenFd(O_RDONLY, 0);
+    if (m_fd < 0) return nullptr;
+    bool size_ok = fstat(m_fd, &m_stat) == 0 && m_stat.st_size > 0 &&
+                   (m_mem_size == 0 ||
+                    m_mem_size == static_cast<size_t>(m_stat.st_size));
+    if (!size_ok) {
+        close(m_fd);
+        m_fd = -1;
+        return nullptr;
+    }
+    m_mem_size = static_cast<size_t>(m_stat.st_size);
+
+    void* addr = mmap(nullptr, m_mem_size, PROT_READ, MAP_SHARED, m_fd, 0);
+    if (addr == MAP_FAILED) {
+        close(m_fd);
+        m_fd = -1;
+        return nullptr;
+    }
+    m_addr = addr;
     return m_addr;
 }
 
@@ -43,4 +113,35 @@ size_t SharedMemory::GetSize() const noexcept {
     return m_fd < 0 ? 0 : m_mem_size;
 }
 
+bool SharedMemory::Sync(size_t offset, size_t len, bool async) {
+    if (m_addr == nullptr || offset >= m_mem_size) return false;
+    // a shm segment has no backing store, there is nothing to write back
+    if (m_backing != Backing::kFile) return true;
+    if (len == 0 || len > m_mem_size - offset) len = m_mem_size - offset;
+
+    // msync wants a page aligned start
+    size_t page  = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t begin = offset / page * page;
+    char* addr   = static_cast<char*>(m_addr) + begin;
+    return msync(addr, offset + len - begin, async ? MS_ASYNC : MS_SYNC) == 0;
+}
+
+uint64_t SharedMemory::BootId() {
+    static const uint64_t boot_id = [] {
+        char buf[64] = {0};
+        int fd = open("/proc/sys/kernel/random/boot_id", O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return uint64_t(0);
+        ssize_t len = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        if (len <= 0) return uint64_t(0);
+        // FNV-1a
+        uint64_t hash = 14695981039346656037ull;
+        for (ssize_t i = 0; i < len && buf[i] != '\n'; ++i) {
+            hash = (hash ^ static_cast<uint8_t>(buf[i])) * 1099511628211ull;
+        }
+        return hash;
+    }();
+    return boot_id;
+}
+
 }  // namespace cbase
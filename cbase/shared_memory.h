@@ -1,6 +1,7 @@
 #pragma once
 
 #include <sys/stat.h>
+#include <cstdint>
 #include <cstdlib>
 #include <string>
 
@@ -8,20 +9,44 @@ namespace cbase {
 
 class SharedMemory {
 public:
-    SharedMemory(const std::string& name, size_t mem_size);
+    // kShm segments live in /dev/shm and are gone after a reboot. kFile maps
+    // the regular file at path name instead, so what was synced survives.
+    enum class Backing { kShm, kFile };
+
+    SharedMemory(const std::string& name, size_t mem_size,
+                 Backing backing = Backing::kShm);
+    // unmaps, the segment or file itself is kept
     ~SharedMemory();
 
     SharedMemory(const SharedMemory&) = delete;
     SharedMemory& operator=(const SharedMemory&) = delete;
 
     void* Open();
+    // maps an existing segment of mem_size bytes without creating it,
+    // nullptr if it does not exist or has another size
+    void* Attach();
+    // maps an existing segment read only, its size is taken from the
+    // segment when mem_size is 0. nullptr if it does not exist.
+    const void* OpenReadOnly();
     void* GetAddress() const noexcept;
     size_t GetSize() const noexcept;
+    bool IsFileBacked() const noexcept { return m_backing == Backing::kFile; }
+
+    // writes [offset, offset + len) of a kFile mapping back to the file,
+    // len 0 means up to the end. Waits for the disk unless async.
+    bool Sync(size_t offset = 0, size_t len = 0, bool async = false);
+
+    // hash of the kernel boot id, changes on every reboot. 0 if unknown.
+    static uint64_t BootId();
+
+private:
+    int OpenFd(int flags, int mode) const;
 
 private:
     int32_t m_fd;
     std::string m_name;
     size_t m_mem_size;
+    Backing m_backing;
     void* m_addr;
     struct stat m_stat;
 };
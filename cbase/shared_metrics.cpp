@@ -0,0 +1,205 @@
+#include "shared_metrics.h"
+
+#include <string.h>
+#include <cassert>
+
+namespace cbase {
+
+namespace {
+
+constexpr uint64_t kCacheLine = 64;
+
+uint64_t AlignUp(uint64_t size) {
+    return (size + kCacheLine - 1) & ~(kCacheLine - 1);
+}
+
+}  // namespace
+
+MetricsRegistry::MetricsRegistry(const std::string& name, uint32_t max_metrics,
+                                 uint32_t shard_cnt, size_t value_size)
+    : m_name(name),
+      m_max_metrics(max_metrics),
+      m_shard_cnt(shard_cnt == 0 ? 1 : shard_cnt),
+      m_value_size(AlignUp(value_size)),
+      m_shared_memory(nullptr),
+      m_header(nullptr) {}
+
+bool MetricsRegistry::Init() {
+    uint64_t desc_offset = sizeof(MetricsHeader);
+    uint64_t value_offset =
+        AlignUp(desc_offset + sizeof(MetricDesc) * m_max_metrics);
+    size_t total_size = value_offset + m_value_size;
+
+    m_shared_memory.reset(new SharedMemory(m_name, total_size));
+    m_header = reinterpret_cast<MetricsHeader*>(m_shared_memory->Open());
+    // a segment of another size, e.g. created with other max_metrics
+    if (m_header == nullptr) return false;
+
+    if (__atomic_load_n(&m_header->m_magic, __ATOMIC_ACQUIRE) ==
+        MetricsHeader::kMagic) {
+        // reattach, keep the metrics of the previous run
+        return m_header->m_version == MetricsHeader::kVersion &&
+               m_header->m_shard_cnt == m_shard_cnt &&
+               m_header->m_max_metrics == m_max_metrics &&
+               m_header->m_value_offset == value_offset;
+    }
+
+    memset(m_header, 0, total_size);
+    m_header->m_version      = MetricsHeader::kVersion;
+    m_header->m_shard_cnt    = m_shard_cnt;
+    m_header->m_max_metrics  = m_max_metrics;
+    m_header->m_metric_cnt   = 0;
+    m_header->m_desc_offset  = desc_offset;
+    m_header->m_value_offset = value_offset;
+    m_header->m_value_size   = m_value_size;
+    m_header->m_value_used   = 0;
+    __atomic_store_n(&m_header->m_magic, MetricsHeader::kMagic,
+                     __ATOMIC_RELEASE);
+    return true;
+}
+
+uint64_t MetricsRegistry::ValueSize(MetricType type) const noexcept {
+    switch (type) {
+        case MetricType::COUNTER:
+            return kCacheLine * m_shard_cnt;
+        case MetricType::GAUGE:
+            return kCacheLine;
+        case MetricType::HISTOGRAM:
+            return sizeof(MetricHistogram::Shard) * m_shard_cnt;
+    }
+    return 0;
+}
+
+uint64_t MetricsRegistry::AddMetric(const std::string& name, MetricType type) {
+    assert(m_header != nullptr && "registry not inited.");
+    if (name.empty() || name.size() > MetricDesc::kMaxNameLen) return 0;
+
+    MetricDesc* descs = Descs();
+    uint32_t cnt      = m_header->m_metric_cnt;
+    for (uint32_t i = 0; i < cnt; ++i) {
+        if (name == descs[i].m_name) {
+            return descs[i].m_type == static_cast<uint32_t>(type)
+                       ? descs[i].m_value_offset
+                       : 0;
+        }
+    }
+
+    uint64_t size = ValueSize(type);
+    if (cnt >= m_header->m_max_metrics ||
+        m_header->m_value_used + size > m_header->m_value_size) {
+        return 0;
+    }
+
+    MetricDesc& desc    = descs[cnt];
+    desc.m_type         = static_cast<uint32_t>(type);
+    desc.m_value_offset = m_header->m_value_offset + m_header->m_value_used;
+    memcpy(desc.m_name, name.data(), name.size());
+    desc.m_name[name.size()] = '\0';
+    m_header->m_value_used += size;
+    // readers only look at descs below the published count
+    __atomic_store_n(&m_header->m_metric_cnt, cnt + 1, __ATOMIC_RELEASE);
+    return desc.m_value_offset;
+}
+
+MetricCounter* MetricsRegistry::AddCounter(const std::string& name) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uint64_t offset = AddMetric(name, MetricType::COUNTER);
+    if (offset == 0) return nullptr;
+    m_counters.emplace_back(new MetricCounter(
+        reinterpret_cast<uint64_t*>(Base() + offset), m_shard_cnt));
+    return m_counters.back().get();
+}
+
+MetricGauge* MetricsRegistry::AddGauge(const std::string& name) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uint64_t offset = AddMetric(name, MetricType::GAUGE);
+    if (offset == 0) return nullptr;
+    m_gauges.emplace_back(
+        new MetricGauge(reinterpret_cast<int64_t*>(Base() + offset)));
+    return m_gauges.back().get();
+}
+
+MetricHistogram* MetricsRegistry::AddHistogram(const std::string& name) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uint64_t offset = AddMetric(name, MetricType::HISTOGRAM);
+    if (offset == 0) return nullptr;
+    m_histograms.emplace_back(new MetricHistogram(
+        reinterpret_cast<MetricHistogram::Shard*>(Base() + offset),
+        m_shard_cnt));
+    return m_histograms.back().get();
+}
+
+MetricsReader::MetricsReader(const std::string& name)
+    : m_name(name), m_shared_memory(nullptr), m_header(nullptr) {}
+
+bool MetricsReader::Open() {
+    m_shared_memory.reset(new SharedMemory(m_name, 0));
+    const void* addr = m_shared_memory->OpenReadOnly();
+    if (addr == nullptr) return false;
+
+    const MetricsHeader* header = static_cast<const MetricsHeader*>(addr);
+    if (__atomic_load_n(&header->m_magic, __ATOMIC_ACQUIRE) !=
+            MetricsHeader::kMagic ||
+        header->m_version != MetricsHeader::kVersion ||
+        header->m_value_offset + header->m_value_size >
+            m_shared_memory->GetSize()) {
+        return false;
+    }
+    m_header = header;
+    return true;
+}
+
+std::vector<MetricSample> MetricsReader::Scrape() const {
+    std::vector<MetricSample> samples;
+    if (m_header == nullptr) return samples;
+
+    uint32_t cnt = __atomic_load_n(&m_header->m_metric_cnt, __ATOMIC_ACQUIRE);
+    uint32_t shard_cnt = m_header->m_shard_cnt;
+    const MetricDesc* descs =
+        reinterpret_cast<const MetricDesc*>(Base() + m_header->m_desc_offset);
+    samples.reserve(cnt);
+
+    for (uint32_t i = 0; i < cnt; ++i) {
+        const MetricDesc& desc = descs[i];
+        const char* value      = Base() + desc.m_value_offset;
+        MetricSample sample;
+        sample.m_name  = desc.m_name;
+        sample.m_type  = static_cast<MetricType>(desc.m_type);
+        sample.m_value = 0;
+        sample.m_sum   = 0;
+
+        if (sample.m_type == MetricType::COUNTER) {
+            const uint64_t* shards = reinterpret_cast<const uint64_t*>(value);
+            uint64_t total         = 0;
+            for (uint32_t s = 0; s < shard_cnt; ++s) {
+                total += __atomic_load_n(&shards[s * MetricCounter::kStride],
+                                         __ATOMIC_RELAXED);
+            }
+            sample.m_value = static_cast<int64_t>(total);
+        } else if (sample.m_type == MetricType::GAUGE) {
+            sample.m_value = __atomic_load_n(
+                reinterpret_cast<const int64_t*>(value), __ATOMIC_RELAXED);
+        } else if (sample.m_type == MetricType::HISTOGRAM) {
+            const MetricHistogram::Shard* shards =
+                reinterpret_cast<const MetricHistogram::Shard*>(value);
+            sample.m_buckets.assign(MetricHistogram::kBucketCnt, 0);
+            uint64_t count = 0;
+            for (uint32_t s = 0; s < shard_cnt; ++s) {
+                count += __atomic_load_n(&shards[s].m_count, __ATOMIC_RELAXED);
+                sample.m_sum +=
+                    __atomic_load_n(&shards[s].m_sum, __ATOMIC_RELAXED);
+                for (uint32_t b = 0; b < MetricHistogram::kBucketCnt; ++b) {
+                    sample.m_buckets[b] += __atomic_load_n(
+                        &shards[s].m_buckets[b], __ATOMIC_RELAXED);
+                }
+            }
+            sample.m_value = static_cast<int64_t>(count);
+        } else {
+            continue;
+        }
+        samples.push_back(std::move(sample));
+    }
+    return samples;
+}
+
+}  // namespace cbase
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>  // NOLINT
+#include <string>
+#include <vector>
+#include "shared_memory.h"
+#include "thread_index.h"
+
+namespace cbase {
+
+enum class MetricType : uint32_t { COUNTER = 1, GAUGE = 2, HISTOGRAM = 3 };
+
+// Layout of a metrics segment, every block starts on a cache line:
+//   MetricsHeader | MetricDesc[max_metrics] | values
+// A counter owns one cache line per shard, a gauge one cache line and a
+// histogram one MetricHistogram::Shard per shard.
+struct MetricsHeader {
+    static constexpr uint64_t kMagic   = 0x43424d4554524943ull;  // CBMETRIC
+    static constexpr uint32_t kVersion = 1;
+
+    uint64_t m_magic;  // written last when the segment is initialized
+    uint32_t m_version;
+    uint32_t m_shard_cnt;
+    uint32_t m_max_metrics;
+    uint32_t m_metric_cnt;  // published with release, read with acquire
+    uint64_t m_desc_offset;
+    uint64_t m_value_offset;
+    uint64_t m_value_size;
+    uint64_t m_value_used;
+    char m_reserved[8];
+};
+static_assert(sizeof(MetricsHeader) == 64, "unexpect header size.");
+
+struct MetricDesc {
+    static constexpr size_t kMaxNameLen = 111;
+
+    char m_name[kMaxNameLen + 1];
+    uint32_t m_type;
+    uint32_t m_reserved;
+    uint64_t m_value_offset;  // from the segment start
+};
+static_assert(sizeof(MetricDesc) == 128, "unexpect desc size.");
+
+class MetricCounter {
+public:
+    MetricCounter(uint64_t* shards, uint32_t shard_cnt)
+        : m_shards(shards), m_shard_cnt(shard_cnt) {}
+
+    void Add(uint64_t delta = 1) noexcept {
+        uint32_t shard = ThisThreadIndex() % m_shard_cnt;
+        __atomic_fetch_add(&m_shards[shard * kStride], delta,
+                           __ATOMIC_RELAXED);
+    }
+
+    static constexpr uint32_t kStride = 64 / sizeof(uint64_t);
+
+private:
+    uint64_t* m_shards;
+    const uint32_t m_shard_cnt;
+};
+
+class MetricGauge {
+public:
+    explicit MetricGauge(int64_t* value) : m_value(value) {}
+
+    void Set(int64_t value) noexcept {
+        __atomic_store_n(m_value, value, __ATOMIC_RELAXED);
+    }
+    void Add(int64_t delta) noexcept {
+        __atomic_fetch_add(m_value, delta, __ATOMIC_RELAXED);
+    }
+
+private:
+    int64_t* m_value;
+};
+
+// power of two buckets: bucket i counts values in [2^(i-1), 2^i)
+class MetricHistogram {
+public:
+    static constexpr uint32_t kBucketCnt = 65;
+
+    struct alignas(64) Shard {
+        uint64_t m_count;
+        uint64_t m_sum;
+        uint64_t m_buckets[kBucketCnt];
+    };
+
+    MetricHistogram(Shard* shards, uint32_t shard_cnt)
+        : m_shards(shards), m_shard_cnt(shard_cnt) {}
+
+    static uint32_t BucketIndex(uint64_t value) noexcept {
+        return value == 0 ? 0 : 64 - __builtin_clzll(value);
+    }
+
+    void Record(uint64_t value) noexcept {
+        Shard* shard = &m_shards[ThisThreadIndex() % m_shard_cnt];
+        __atomic_fetch_add(&shard->m_buckets[BucketIndex(value)], 1,
+                           __ATOMIC_RELAXED);
+        __atomic_fetch_add(&shard->m_sum, value, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&shard->m_count, 1, __ATOMIC_RELAXED);
+    }
+
+private:
+    Shard* m_shards;
+    const uint32_t m_shard_cnt;
+};
+
+// Owns the metrics segment of a process. Values live in shared memory and
+// are updated with relaxed atomics on per-thread shards, a reader process
+// maps the segment read only and aggregates when it scrapes. A single
+// writer process per segment; metrics are kept when it reattaches.
+class MetricsRegistry {
+public:
+    MetricsRegistry(const std::string& name, uint32_t max_metrics = 256,
+                    uint32_t shard_cnt = 16, size_t value_size = 1 << 20);
+    ~MetricsRegistry() {}
+
+    MetricsRegistry(const MetricsRegistry&) = delete;
+    MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+    bool Init();
+
+    // returns the existing metric of the same name and type if any,
+    // nullptr when the segment is full or the type differs
+    MetricCounter* AddCounter(const std::string& name);
+    MetricGauge* AddGauge(const std::string& name);
+    MetricHistogram* AddHistogram(const std::string& name);
+
+private:
+    // offset of the metric values, 0 if it cannot be added
+    uint64_t AddMetric(const std::string& name, MetricType type);
+    uint64_t ValueSize(MetricType type) const noexcept;
+
+    char* Base() const noexcept { return reinterpret_cast<char*>(m_header); }
+    MetricDesc* Descs() const noexcept {
+        return reinterpret_cast<MetricDesc*>(Base() + m_header->m_desc_offset);
+    }
+
+private:
+    const std::string m_name;
+    const uint32_t m_max_metrics;
+    const uint32_t m_shard_cnt;
+    const size_t m_value_size;
+    std::unique_ptr<SharedMemory> m_shared_memory;
+    MetricsHeader* m_header;
+
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<MetricCounter>> m_counters;
+    std::vector<std::unique_ptr<MetricGauge>> m_gauges;
+    std::vector<std::unique_ptr<MetricHistogram>> m_histograms;
+};  // class MetricsRegistry
+
+struct MetricSample {
+    std::string m_name;
+    MetricType m_type;
+    int64_t m_value;  // counter total, gauge value, histogram count
+    uint64_t m_sum;   // histogram only
+    std::vector<uint64_t> m_buckets;  // histogram only
+};
+
+// Read only view of a metrics segment, for a sidecar process.
+class MetricsReader {
+public:
+    explicit MetricsReader(const std::string& name);
+    ~MetricsReader() {}
+
+    MetricsReader(const MetricsReader&) = delete;
+    MetricsReader& operator=(const MetricsReader&) = delete;
+
+    // false if the segment does not exist or is not a metrics segment
+    bool Open();
+
+    std::vector<MetricSample> Scrape() const;
+
+private:
+    const char* Base() const noexcept {
+        return reinterpret_cast<const char*>(m_header);
+    }
+
+private:
+    const std::string m_name;
+    std::unique_ptr<SharedMemory> m_shared_memory;
+    const MetricsHeader* m_header;
+};  // class MetricsReader
+
+}  // namespace cbase
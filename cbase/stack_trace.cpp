@@ -1,67 +1,149 @@
 #include "stack_trace.h"
 
 #include <cxxabi.h>
+#include <dlfcn.h>
 #include <execinfo.h>
 #include <stdlib.h>
-#include <sstream>
+#include <string.h>
+#include <algorithm>
+#include <cstdio>
+#include <mutex>  // NOLINT
+#include <unordered_map>
 
 namespace cbase {
 
-std::string StackTrace(uint32_t max_frames) {
-    void* addrlist[max_frames + 1];
-    int addrlen = backtrace(addrlist, sizeof(addrlist) / sizeof(void*));
-    if (addrlen == 0) {
-        return "no stack get.";
+namespace {
+
+// backtrace loads libgcc on its first call, which allocates. Do that once
+// at startup so later calls, e.g. from signal handlers, are safe.
+struct BacktracePrimer {
+    BacktracePrimer() {
+        void* frame = nullptr;
+        backtrace(&frame, 1);
+    }
+};
+static BacktracePrimer s_backtrace_primer;
+
+struct Symbol {
+    std::string m_module;
+    std::string m_function;  // empty if unknown
+    size_t m_offset;
+};
+
+class SymbolCache {
+public:
+    static SymbolCache& Instance() {
+        // never destroyed, traces may be symbolized during exit
+        static SymbolCache* cache = new SymbolCache();
+        return *cache;
+    }
+
+    Symbol Get(void* frame) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_symbols.find(frame);
+            if (it != m_symbols.end()) return it->second;
+        }
+        Symbol symbol = Resolve(frame);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_symbols.size() >= kMaxEntries) m_symbols.clear();
+        m_symbols.emplace(frame, symbol);
+        return symbol;
     }
 
-    std::stringstream stream;
-
-    char** symbollist    = backtrace_symbols(addrlist, addrlen);
-    size_t funcname_size = 256;
-    char* funcname       = (char*)malloc(funcname_size);  // NOLINT
-
-    for (int i = 1; i < addrlen; ++i) {
-        char* begin_name   = 0;
-        char* begin_offset = 0;
-        char* end_offset   = 0;
-
-        for (char* p = symbollist[i]; *p; ++p) {
-            if (*p == '(') {
-                begin_name = p;
-            } else if (*p == '+') {
-                begin_offset = p;
-            } else if (*p == ')' && begin_offset) {
-                end_offset = p;
-                break;
-            }
+private:
+    static constexpr size_t kMaxEntries = 1 << 16;
+
+    static Symbol Resolve(void* frame) {
+        Symbol symbol{std::string(), std::string(), 0};
+        Dl_info info;
+        if (dladdr(frame, &info) == 0) return symbol;
+
+        symbol.m_module = info.dli_fname ? info.dli_fname : "??";
+        if (info.dli_sname == nullptr) {
+            // offset into the module, as backtrace_symbols has it
+            symbol.m_offset = static_cast<size_t>(
+                static_cast<char*>(frame) - static_cast<char*>(info.dli_fbase));
+            return symbol;
         }
 
-        if (begin_name && begin_offset && end_offset &&
-            begin_name < begin_offset) {
-            *begin_name++   = '\0';
-            *begin_offset++ = '\0';
-            *end_offset++   = '\0';
-
-            int status = 0;
-            char* ret  = abi::__cxa_demangle(begin_name, funcname,
-                                            &funcname_size, &status);
-            if (status == 0) {
-                funcname = ret;
-                stream << symbollist[i] << " : " << funcname << "+"
-                       << begin_offset << "\n";
-            } else {
-                stream << symbollist[i] << " : " << begin_name << "()+"
-                       << begin_offset << "\n";
-            }
+        int status     = 0;
+        char* demangle = abi::__cxa_demangle(info.dli_sname, nullptr,
+                                             nullptr, &status);
+        if (status == 0 && demangle != nullptr) {
+            symbol.m_function = demangle;
         } else {
-            stream << symbollist[i] << "\n";
+            symbol.m_function = std::string(info.dli_sname) + "()";
         }
+        free(demangle);
+        symbol.m_offset = static_cast<size_t>(
+            static_cast<char*>(frame) - static_cast<char*>(info.dli_saddr));
+        return symbol;
+    }
+
+private:
+    std::mutex m_mutex;
+    std::unordered_map<void*, Symbol> m_symbols;
+};
+
+}  // namespace
+
+int CaptureStack(void** frames, int max_frames, int skip) {
+    if (max_frames <= 0) return 0;
+    void* buf[kMaxStackFrames];
+    int cnt = backtrace(buf, kMaxStackFrames);
+    // buf[0] is CaptureStack itself
+    int begin = std::min(cnt, skip + 1);
+    int n     = std::min(cnt - begin, max_frames);
+    memcpy(frames, buf + begin, sizeof(void*) * n);
+    return n;
+}
+
+void WriteStack(int fd, void* const* frames, int frame_cnt) {
+    backtrace_symbols_fd(frames, frame_cnt, fd);
+}
+
+std::string SymbolizeFrame(void* frame) {
+    char buf[32];
+    Symbol symbol = SymbolCache::Instance().Get(frame);
+    if (symbol.m_module.empty()) {
+        snprintf(buf, sizeof(buf), "[%p]", frame);
+        return buf;
     }
+    snprintf(buf, sizeof(buf), "+0x%zx", symbol.m_offset);
+    // the format StackTrace had with backtrace_symbols, an empty () when
+    // the frame has no symbol
+    std::string function =
+        symbol.m_function.empty() ? std::string("()") : symbol.m_function;
+    return symbol.m_module + " : " + function + buf;
+}
+
+std::string FunctionName(void* frame) {
+    Symbol symbol = SymbolCache::Instance().Get(frame);
+    if (!symbol.m_function.empty()) return symbol.m_function;
 
-    free(funcname);
-    free(symbollist);
+    char buf[32];
+    snprintf(buf, sizeof(buf), "[%p]", frame);
+    return symbol.m_module.empty() ? buf : symbol.m_module + buf;
+}
+
+std::string SymbolizeStack(void* const* frames, int frame_cnt) {
+    std::string stack;
+    for (int i = 0; i < frame_cnt; ++i) {
+        stack.append(SymbolizeFrame(frames[i])).append("\n");
+    }
+    return stack;
+}
 
-    return stream.str();
+std::string StackTrace(uint32_t max_frames) {
+    void* frames[kMaxStackFrames];
+    int max_cnt = static_cast<int>(
+        std::min<uint32_t>(max_frames, static_cast<uint32_t>(kMaxStackFrames)));
+    int cnt = CaptureStack(frames, max_cnt, 1);
+    if (cnt == 0) {
+        return "no stack get.";
+    }
+    return SymbolizeStack(frames, cnt);
 }
 
 }  // namespace cbase
@@ -1,9 +1,33 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 
 namespace cbase {
 
+// upper bound of frames captured by a single call
+constexpr int kMaxStackFrames = 128;
+
+// Stores up to max_frames return addresses of the calling thread into
+// frames, skipping the innermost skip frames (CaptureStack itself is never
+// reported). No allocation nor lock, safe to call from a signal handler.
+// Returns the number of frames stored.
+int CaptureStack(void** frames, int max_frames, int skip = 0);
+
+// Writes "module(symbol+offset) [addr]" lines to fd without allocating,
+// for crash handlers that cannot symbolize properly.
+void WriteStack(int fd, void* const* frames, int frame_cnt);
+
+// "module : symbol+0xoffset" for one address, "module : ()+0xoffset" with
+// the offset into the module if it has no symbol. Results are cached
+// process wide, so symbolizing the same hot stacks again is a hash lookup.
+std::string SymbolizeFrame(void* frame);
+std::string SymbolizeStack(void* const* frames, int frame_cnt);
+
+// demangled function name only, "module[addr]" if it has no symbol
+std::string FunctionName(void* frame);
+
+// capture and symbolize the current stack in one call
 std::string StackTrace(uint32_t max_frames = 63);
 
 }  // namespace cbase
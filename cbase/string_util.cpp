@@ -1,5 +1,14 @@
 #include "string_util.h"
 
+#include <charconv>
+#include <system_error>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 namespace cbase {
 
 std::vector<std::string> Tokenize(const std::string& s, char c) {
@@ -21,4 +30,140 @@ std::vector<std::string> Tokenize(const std::string& s, char c) {
     return v;
 }
 
+DelimiterSet::DelimiterSet(std::string_view delims)
+    : m_table{0, 0, 0, 0}, m_chars{0}, m_cnt(0) {
+    for (char c : delims) {
+        if (Contains(c)) continue;
+        uint8_t u = static_cast<uint8_t>(c);
+        m_table[u >> 6] |= uint64_t(1) << (u & 63);
+        if (m_cnt < kMaxSimdDelimiters) m_chars[m_cnt] = c;
+        ++m_cnt;
+    }
+}
+
+const char* DelimiterSet::FindFirst(const char* begin,
+                                    const char* end) const noexcept {
+    const char* p = begin;
+    if (m_cnt == 0) return end;
+
+    if (m_cnt <= kMaxSimdDelimiters) {
+#if defined(__AVX2__)
+        __m256i needles[kMaxSimdDelimiters];
+        for (size_t i = 0; i < m_cnt; ++i) {
+            needles[i] = _mm256_set1_epi8(m_chars[i]);
+        }
+        for (; p + 32 <= end; p += 32) {
+            __m256i chunk =
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+            __m256i hit = _mm256_cmpeq_epi8(chunk, needles[0]);
+            for (size_t i = 1; i < m_cnt; ++i) {
+                hit = _mm256_or_si256(hit,
+                                      _mm256_cmpeq_epi8(chunk, needles[i]));
+            }
+            uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(hit));
+            if (mask != 0) return p + __builtin_ctz(mask);
+        }
+#elif defined(__SSE2__)
+        __m128i needles[kMaxSimdDelimiters];
+        for (size_t i = 0; i < m_cnt; ++i) {
+            needles[i] = _mm_set1_epi8(m_chars[i]);
+        }
+        for (; p + 16 <= end; p += 16) {
+            __m128i chunk =
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            __m128i hit   = _mm_cmpeq_epi8(chunk, needles[0]);
+            for (size_t i = 1; i < m_cnt; ++i) {
+                hit = _mm_or_si128(hit, _mm_cmpeq_epi8(chunk, needles[i]));
+            }
+            uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(hit));
+            if (mask != 0) return p + __builtin_ctz(mask);
+        }
+#endif
+    }
+
+    for (; p < end; ++p) {
+        if (Contains(*p)) return p;
+    }
+    return end;
+}
+
+bool Tokenizer::Next(std::string_view* field) noexcept {
+    if (m_keep_empty) {
+        if (m_done) return false;
+        const char* p = m_delims.FindFirst(m_cur, m_end);
+        *field        = std::string_view(m_cur, p - m_cur);
+        if (p == m_end) {
+            m_done = true;
+        } else {
+            m_cur = p + 1;
+        }
+        return true;
+    }
+
+    while (m_cur < m_end && m_delims.Contains(*m_cur)) ++m_cur;
+    if (m_cur == m_end) return false;
+    const char* p = m_delims.FindFirst(m_cur, m_end);
+    *field        = std::string_view(m_cur, p - m_cur);
+    m_cur         = p;
+    return true;
+}
+
+size_t TokenizeView(std::string_view s, const DelimiterSet& delims,
+                    std::vector<std::string_view>* fields, bool keep_empty) {
+    fields->clear();
+    Tokenizer tokenizer(s, delims, keep_empty);
+    std::string_view field;
+    while (tokenizer.Next(&field)) {
+        fields->push_back(field);
+    }
+    return fields->size();
+}
+
+std::string_view TrimView(std::string_view s) noexcept {
+    auto is_space = [](char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' ||
+               c == '\f';
+    };
+    size_t begin = 0;
+    size_t end   = s.size();
+    while (begin < end && is_space(s[begin])) ++begin;
+    while (end > begin && is_space(s[end - 1])) --end;
+    return s.substr(begin, end - begin);
+}
+
+namespace {
+
+template <class T>
+bool ParseNumber(std::string_view s, T* value) noexcept {
+    s = TrimView(s);
+    // from_chars rejects '+' and nothing else should, but it takes the
+    // '-' of "+-5"
+    if (!s.empty() && s[0] == '+') {
+        s.remove_prefix(1);
+        if (!s.empty() && (s[0] == '-' || s[0] == '+')) return false;
+    }
+    if (s.empty()) return false;
+
+    T parsed        = 0;
+    const char* end = s.data() + s.size();
+    auto result     = std::from_chars(s.data(), end, parsed);
+    if (result.ec != std::errc() || result.ptr != end) return false;
+    *value = parsed;
+    return true;
+}
+
+}  // namespace
+
+bool ParseInt64(std::string_view s, int64_t* value) noexcept {
+    return ParseNumber(s, value);
+}
+
+bool ParseUint64(std::string_view s, uint64_t* value) noexcept {
+    return ParseNumber(s, value);
+}
+
+bool ParseDouble(std::string_view s, double* value) noexcept {
+    return ParseNumber(s, value);
+}
+
 }  // namespace cbase
@@ -1,10 +1,82 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace cbase {
 
 std::vector<std::string> Tokenize(const std::string& s, char c);
 
+// Delimiter chars for the string_view tokenizers. Up to kMaxSimdDelimiters
+// chars are matched 16/32 bytes at a time with SSE2/AVX2, larger sets fall
+// back to a byte by byte table lookup.
+class DelimiterSet {
+public:
+    static constexpr size_t kMaxSimdDelimiters = 8;
+
+    DelimiterSet(std::string_view delims);  // NOLINT
+    DelimiterSet(const char* delims)        // NOLINT
+        : DelimiterSet(std::string_view(delims)) {}
+    DelimiterSet(char c) : DelimiterSet(std::string_view(&c, 1)) {}  // NOLINT
+
+    bool Contains(char c) const noexcept {
+        uint8_t u = static_cast<uint8_t>(c);
+        return (m_table[u >> 6] >> (u & 63)) & 1;
+    }
+
+    // first delimiter in [begin, end), end if there is none
+    const char* FindFirst(const char* begin, const char* end) const noexcept;
+
+private:
+    uint64_t m_table[4];
+    char m_chars[kMaxSimdDelimiters];
+    size_t m_cnt;  // > kMaxSimdDelimiters means table lookup only
+};
+
+// Lazily yields fields of s as views into it, nothing is allocated.
+// Without keep_empty, runs of delimiters are collapsed like Tokenize does;
+// with it, n delimiters always give n + 1 fields.
+//
+//   Tokenizer tokenizer(line, "\t ");
+//   std::string_view field;
+//   while (tokenizer.Next(&field)) { ... }
+class Tokenizer {
+public:
+    Tokenizer(std::string_view s, const DelimiterSet& delims,
+              bool keep_empty = false)
+        : m_cur(s.data()),
+          m_end(s.data() + s.size()),
+          m_delims(delims),
+          m_keep_empty(keep_empty),
+          m_done(false) {}
+
+    bool Next(std::string_view* field) noexcept;
+
+private:
+    const char* m_cur;
+    const char* m_end;
+    DelimiterSet m_delims;
+    const bool m_keep_empty;
+    bool m_done;
+};
+
+// clears fields then appends every field of s, so a vector reused across
+// lines stops allocating once it has grown. Returns the field count.
+size_t TokenizeView(std::string_view s, const DelimiterSet& delims,
+                    std::vector<std::string_view>* fields,
+                    bool keep_empty = false);
+
+// Locale independent number parsing without exceptions, surrounding ASCII
+// whitespace is ignored and the rest of s must be the number. On failure
+// value is left untouched and false is returned.
+bool ParseInt64(std::string_view s, int64_t* value) noexcept;
+bool ParseUint64(std::string_view s, uint64_t* value) noexcept;
+bool ParseDouble(std::string_view s, double* value) noexcept;
+
+// s without leading and trailing ASCII whitespace
+std::string_view TrimView(std::string_view s) noexcept;
+
 }  // namespace cbase
@@ -0,0 +1,67 @@
+// Compares Tokenize against the string_view tokenizers on TSV like lines.
+// g++ -std=c++17 -O2 -mavx2 string_util_bench.cpp string_util.cpp
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "chrono_time_elapser.h"
+#include "string_util.h"
+
+static std::vector<std::string> MakeLines(size_t cnt, int fields) {
+    std::vector<std::string> lines;
+    lines.reserve(cnt);
+    srand(42);
+    for (size_t i = 0; i < cnt; ++i) {
+        std::string line;
+        for (int f = 0; f < fields; ++f) {
+            if (f > 0) line.push_back('\t');
+            int len = 1 + rand() % 24;  // NOLINT
+            for (int c = 0; c < len; ++c) line.push_back('a' + rand() % 26);
+        }
+        lines.push_back(std::move(line));
+    }
+    return lines;
+}
+
+template <class Func>
+static void Bench(const char* name, const std::vector<std::string>& lines,
+                  Func func) {
+    size_t bytes = 0;
+    for (const auto& line : lines) bytes += line.size();
+
+    size_t total = 0;
+    cbase::ChronoTimeElapser elapser;
+    for (const auto& line : lines) total += func(line);
+    uint64_t micros = elapser.ElapsedTime();
+    printf("%-14s %8.1f ns/line %8.1f MB/s  (%zu fields)\n", name,
+           micros * 1000.0 / lines.size(),
+           micros == 0 ? 0.0 : static_cast<double>(bytes) / micros, total);
+}
+
+int main(int argc, char** argv) {
+    size_t cnt = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+    for (int fields : {4, 16, 64}) {
+        std::vector<std::string> lines = MakeLines(cnt, fields);
+        printf("fields per line: %d\n", fields);
+
+        Bench("Tokenize", lines, [](const std::string& line) {
+            return cbase::Tokenize(line, '\t').size();
+        });
+
+        std::vector<std::string_view> views;
+        cbase::DelimiterSet tab('\t');
+        Bench("TokenizeView", lines, [&](const std::string& line) {
+            return cbase::TokenizeView(line, tab, &views);
+        });
+
+        Bench("Tokenizer", lines, [&](const std::string& line) {
+            cbase::Tokenizer tokenizer(line, tab);
+            std::string_view field;
+            size_t n = 0;
+            while (tokenizer.Next(&field)) ++n;
+            return n;
+        });
+    }
+    return 0;
+}
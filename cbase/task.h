@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include "sequence.h"
+
+namespace cbase {
+
+// Move-only replacement of std::function. The callable is always stored
+// inside the task, InlineBytes is checked at compile time, so creating,
+// moving and queueing a task never allocates.
+template <class Sig, std::size_t InlineBytes = 48>
+class task;
+
+template <class R, class... Args, std::size_t InlineBytes>
+class task<R(Args...), InlineBytes> {
+public:
+    task() noexcept : m_ops(nullptr) {}
+    task(std::nullptr_t) noexcept : m_ops(nullptr) {}  // NOLINT
+
+    template <class F, class Fn = typename std::decay<F>::type,
+              class = typename std::enable_if<
+                  !std::is_same<Fn, task>::value>::type>
+    task(F&& f) : m_ops(nullptr) {  // NOLINT
+        static_assert(sizeof(Fn) <= InlineBytes,
+                      "callable is too large for the task inline storage");
+        static_assert(alignof(Fn) <= alignof(std::max_align_t),
+                      "callable is over aligned");
+        new (&m_storage) Fn(std::forward<F>(f));
+        m_ops = &ops_for<Fn>::s_ops;
+    }
+
+    ~task() { reset(); }
+
+    task(task&& other) noexcept : m_ops(other.m_ops) {
+        if (m_ops != nullptr) {
+            m_ops->m_move(&m_storage, &other.m_storage);
+            other.reset();
+        }
+    }
+
+    task& operator=(task&& other) noexcept {
+        if (this == &other) return *this;
+        reset();
+        if (other.m_ops != nullptr) {
+            other.m_ops->m_move(&m_storage, &other.m_storage);
+            m_ops = other.m_ops;
+            other.reset();
+        }
+        return *this;
+    }
+
+    task& operator=(std::nullptr_t) noexcept {
+        reset();
+        return *this;
+    }
+
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+
+    void reset() noexcept {
+        if (m_ops == nullptr) return;
+        m_ops->m_destroy(&m_storage);
+        m_ops = nullptr;
+    }
+
+    explicit operator bool() const noexcept { return m_ops != nullptr; }
+
+    R operator()(Args... args) {
+        assert(m_ops != nullptr && "invoke empty task.");
+        return m_ops->m_invoke(&m_storage, std::forward<Args>(args)...);
+    }
+
+private:
+    struct ops {
+        R (*m_invoke)(void*, Args&&...);
+        void (*m_move)(void*, void*);
+        void (*m_destroy)(void*);
+    };
+
+    template <class Fn>
+    struct ops_for {
+        static R invoke(void* p, Args&&... args) {
+            return call(std::is_void<R>(), p, std::forward<Args>(args)...);
+        }
+        // a void task drops what the callable returns, as std::function
+        static R call(std::true_type, void* p, Args&&... args) {
+            (*static_cast<Fn*>(p))(std::forward<Args>(args)...);
+        }
+        static R call(std::false_type, void* p, Args&&... args) {
+            return (*static_cast<Fn*>(p))(std::forward<Args>(args)...);
+        }
+        static void move(void* dst, void* src) {
+            new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+        }
+        static void destroy(void* p) { static_cast<Fn*>(p)->~Fn(); }
+        static constexpr ops s_ops = {&invoke, &move, &destroy};
+    };
+
+    const ops* m_ops;
+    typename std::aligned_storage<InlineBytes, alignof(std::max_align_t)>::type
+        m_storage;
+};
+
+template <class R, class... Args, std::size_t InlineBytes>
+template <class Fn>
+constexpr typename task<R(Args...), InlineBytes>::ops
+    task<R(Args...), InlineBytes>::ops_for<Fn>::s_ops;
+
+// A callable packed with its arguments, stored by value next to each
+// other. Calling an lvalue passes the arguments as lvalues and can be
+// repeated, calling an rvalue moves them into the call.
+//
+//   task<int()> t(make_deferred(&Parse, std::move(buffer), flags));
+template <class F, class... Args>
+class deferred_call {
+public:
+    explicit deferred_call(F func, Args... args)
+        : m_func(std::move(func)), m_args(std::move(args)...) {}
+
+    template <class G = F>
+    auto operator()() & -> decltype(tuple_apply(
+        std::declval<G&>(), std::declval<std::tuple<Args...>&>())) {
+        return tuple_apply(m_func, m_args);
+    }
+
+    template <class G = F>
+    auto operator()() && -> decltype(tuple_apply(
+        std::declval<G&&>(), std::declval<std::tuple<Args...>&&>())) {
+        return tuple_apply(std::move(m_func), std::move(m_args));
+    }
+
+private:
+    F m_func;
+    std::tuple<Args...> m_args;
+};
+
+template <class F, class... Args>
+deferred_call<typename std::decay<F>::type, typename std::decay<Args>::type...>
+make_deferred(F&& func, Args&&... args) {
+    return deferred_call<typename std::decay<F>::type,
+                         typename std::decay<Args>::type...>(
+        std::forward<F>(func), std::forward<Args>(args)...);
+}
+
+}  // namespace cbase
@@ -0,0 +1,81 @@
+#include "thread_index.h"
+
+#include <mutex>  // NOLINT
+#include <vector>
+
+namespace cbase {
+
+namespace {
+
+class IndexAllocator {
+public:
+    static IndexAllocator& Instance() {
+        // never destroyed, threads may exit after static destruction
+        static IndexAllocator* allocator = new IndexAllocator();
+        return *allocator;
+    }
+
+    // false if every index is taken
+    bool Acquire(uint32_t* index) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_free.empty()) {
+            *index = m_free.back();
+            m_free.pop_back();
+            return true;
+        }
+        if (m_next < kMaxThreadIndex) {
+            *index = m_next++;
+            return true;
+        }
+        return false;
+    }
+
+    void Release(uint32_t index) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_free.push_back(index);
+    }
+
+private:
+    std::mutex m_mutex;
+    uint32_t m_next = 0;
+    std::vector<uint32_t> m_free;
+};
+
+// trivially destructible, so it can still be read after t_holder is gone
+thread_local bool t_holder_destroyed = false;
+
+struct IndexHolder {
+    uint32_t m_index = kNoThreadIndex;
+    ~IndexHolder() {
+        t_holder_destroyed = true;
+        if (m_index == kNoThreadIndex) return;
+        detail::t_thread_index = kNoThreadIndex;
+        IndexAllocator::Instance().Release(m_index);
+    }
+};
+
+thread_local IndexHolder t_holder;
+
+}  // namespace
+
+namespace detail {
+
+thread_local uint32_t t_thread_index = kNoThreadIndex;
+
+uint32_t AssignThreadIndex() noexcept {
+    // nothing would release an index taken from a later thread_local
+    // destructor
+    if (t_holder_destroyed) return kNoThreadIndex;
+    // construct the holder even when no index is left, so the flag above
+    // is set once the thread passes its destruction
+    IndexHolder& holder = t_holder;
+    uint32_t index      = 0;
+    if (!IndexAllocator::Instance().Acquire(&index)) return kNoThreadIndex;
+    holder.m_index = index;
+    t_thread_index = index;
+    return index;
+}
+
+}  // namespace detail
+
+}  // namespace cbase
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include "utils.h"
+
+namespace cbase {
+
+// at most kMaxThreadIndex threads alive at the same time
+constexpr uint32_t kMaxThreadIndex = 1024;
+// what ThisThreadIndex() returns when the calling thread has no index
+constexpr uint32_t kNoThreadIndex = kMaxThreadIndex;
+
+namespace detail {
+extern thread_local uint32_t t_thread_index;
+uint32_t AssignThreadIndex() noexcept;
+}  // namespace detail
+
+// Dense index of the calling thread in [0, kMaxThreadIndex). Two threads
+// alive at the same time never share an index, indexes of exited threads
+// are reused. Used to address per-thread slots without hashing.
+//
+// kNoThreadIndex while every index is taken, or once the thread_local
+// destructors of the thread ran. The caller must not touch a per-thread
+// slot then: it drops its work or takes a shared slow path. A later call
+// tries again.
+inline uint32_t ThisThreadIndex() noexcept {
+    uint32_t index = detail::t_thread_index;
+    if (likely(index != kNoThreadIndex)) return index;
+    return detail::AssignThreadIndex();
+}
+
+}  // namespace cbase
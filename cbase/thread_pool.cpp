@@ -0,0 +1,40 @@
+#include "thread_pool.h"
+
+#include <cassert>
+#include <utility>
+
+namespace cbase {
+
+ThreadPool::ThreadPool(size_t thread_num) {
+    assert(thread_num > 0 && "thread pool without thread.");
+    m_threads.reserve(thread_num);
+    for (size_t i = 0; i < thread_num; ++i) {
+        m_threads.emplace_back(&ThreadPool::Run, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    // an empty task tells one worker to quit
+    for (size_t i = 0; i < m_threads.size(); ++i) {
+        m_tasks.push(Task());
+    }
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::Submit(Task task) {
+    assert(task && "submit empty task.");
+    m_tasks.push(std::move(task));
+}
+
+void ThreadPool::Run() {
+    while (true) {
+        Task task;
+        m_tasks.pop(task);
+        if (!task) break;
+        task();
+    }
+}
+
+}  // namespace cbase
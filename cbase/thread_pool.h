@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <thread>  // NOLINT
+#include <vector>
+#include "concurrent_queue.h"
+#include "task.h"
+
+namespace cbase {
+
+class ThreadPool {
+public:
+    // closures up to kTaskInlineSize bytes are queued without allocating
+    static constexpr size_t kTaskInlineSize = 64;
+    using Task = task<void(), kTaskInlineSize>;
+
+    explicit ThreadPool(size_t thread_num);
+    // finishes the queued tasks then joins
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void Submit(Task task);
+
+    size_t Size() const noexcept { return m_threads.size(); }
+
+private:
+    void Run();
+
+private:
+    concurrent_queue<Task> m_tasks;
+    std::vector<std::thread> m_threads;
+};  // class ThreadPool
+
+}  // namespace cbase
@@ -1,21 +1,29 @@
 #pragma once
 
 #include <cstdint>
+#include "tsc_clock.h"
 
 namespace cbase {
 
+// Elapsed time on TscClock, read with rdtscp. Falls back to steady_clock
+// when the TSC is not reliable.
 class TimeElapser {
 public:
-    TimeElapser();
+    TimeElapser() : m_start_ns(TscClock::NowNanos()) {}
     ~TimeElapser() {}
     TimeElapser(const TimeElapser&) = delete;
     TimeElapser& operator=(const TimeElapser&) = delete;
 
-    uint64_t ElapseMicros() const noexcept;
+    uint64_t ElapseNanos() const noexcept {
+        return TscClock::NowNanos() - m_start_ns;
+    }
+
+    uint64_t ElapseMicros() const noexcept { return ElapseNanos() / 1000; }
+
+    void Reset() noexcept { m_start_ns = TscClock::NowNanos(); }
 
 private:
-    static uint64_t s_frequency;
-    uint64_t m_start_tp{0};
+    uint64_t m_start_ns;
 };  // class TimeElapser
 
 }  // namespace cbase
@@ -0,0 +1,175 @@
+#include "trace_recorder.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <chrono>  // NOLINT
+
+namespace cbase {
+
+namespace {
+
+void WriteEscaped(FILE* file, const char* str) {
+    for (const char* p = str; *p != '\0'; ++p) {
+        if (*p == '"' || *p == '\\') fputc('\\', file);
+        fputc(*p, file);
+    }
+}
+
+}  // namespace
+
+uint32_t TraceThreadId() noexcept {
+    static thread_local uint32_t tid =
+        static_cast<uint32_t>(syscall(SYS_gettid));
+    return tid;
+}
+
+void TraceInstant(const char* name, const char* arg_name,
+                  int64_t value) noexcept {
+    TraceRecorder& recorder = TraceRecorder::Instance();
+    if (likely(!recorder.IsEnabled())) return;
+
+    TraceEvent event;
+    event.m_name        = name;
+    event.m_begin_ticks = TscClock::NowTicks();
+    event.m_end_ticks   = event.m_begin_ticks;
+    event.m_tid         = TraceThreadId();
+    event.m_phase       = 'i';
+    event.m_arg_cnt     = arg_name == nullptr ? 0 : 1;
+    event.m_arg_names[0]  = arg_name;
+    event.m_arg_values[0] = value;
+    recorder.Record(event);
+}
+
+TraceRecorder& TraceRecorder::Instance() {
+    static TraceRecorder* recorder = new TraceRecorder();  // never destroyed
+    return *recorder;
+}
+
+TraceRecorder::TraceRecorder()
+    : m_enabled(false),
+      m_running(false),
+      m_dropped(0),
+      m_file(nullptr),
+      m_first_event(true),
+      m_pid(static_cast<int>(getpid())) {
+    for (auto& ring : m_rings) {
+        ring.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+bool TraceRecorder::Start(const std::string& path, int interval_ms) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_file != nullptr) return false;
+    m_file = fopen(path.c_str(), "w");
+    if (m_file == nullptr) return false;
+
+    fputs("{\"traceEvents\":[\n", m_file);
+    m_first_event = true;
+    m_running.store(true, std::memory_order_release);
+    m_flusher = std::thread([this, interval_ms] {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (m_running.load(std::memory_order_acquire)) {
+            m_cond.wait_for(lock, std::chrono::milliseconds(interval_ms));
+            for (auto& slot : m_rings) {
+                Ring* ring = slot.load(std::memory_order_acquire);
+                if (ring != nullptr) Drain(ring);
+            }
+            fflush(m_file);
+        }
+    });
+    return true;
+}
+
+void TraceRecorder::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running.load(std::memory_order_acquire)) return;
+        m_running.store(false, std::memory_order_release);
+    }
+    m_cond.notify_all();
+    m_flusher.join();
+
+    Flush();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    fputs("\n]}\n", m_file);
+    fclose(m_file);
+    m_file = nullptr;
+}
+
+void TraceRecorder::Flush() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_file == nullptr) return;
+    for (auto& slot : m_rings) {
+        Ring* ring = slot.load(std::memory_order_acquire);
+        if (ring != nullptr) Drain(ring);
+    }
+    fflush(m_file);
+}
+
+void TraceRecorder::Record(const TraceEvent& event) noexcept {
+    uint32_t index = ThisThreadIndex();
+    if (unlikely(index == kNoThreadIndex)) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    Ring* ring = m_rings[index].load(std::memory_order_relaxed);
+    if (unlikely(ring == nullptr)) ring = CreateRing(index);
+
+    uint64_t tail = ring->m_tail.load(std::memory_order_relaxed);
+    uint64_t head = ring->m_head.load(std::memory_order_acquire);
+    if (tail - head >= kRingSize) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    ring->m_events[tail % kRingSize] = event;
+    ring->m_tail.store(tail + 1, std::memory_order_release);
+}
+
+TraceRecorder::Ring* TraceRecorder::CreateRing(uint32_t index) noexcept {
+    // a ring stays with its thread index, a later thread reusing the index
+    // reuses the ring
+    Ring* ring = new Ring();
+    m_rings[index].store(ring, std::memory_order_release);
+    return ring;
+}
+
+void TraceRecorder::Drain(Ring* ring) {
+    uint64_t head = ring->m_head.load(std::memory_order_relaxed);
+    uint64_t tail = ring->m_tail.load(std::memory_order_acquire);
+    for (; head < tail; ++head) {
+        Write(ring->m_events[head % kRingSize]);
+    }
+    ring->m_head.store(tail, std::memory_order_release);
+}
+
+void TraceRecorder::Write(const TraceEvent& event) {
+    if (!m_first_event) fputs(",\n", m_file);
+    m_first_event = false;
+
+    double ts = TscClock::TicksToNanos(event.m_begin_ticks) / 1000.0;
+    fputs("{\"name\":\"", m_file);
+    WriteEscaped(m_file, event.m_name);
+    fprintf(m_file, "\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%u",
+            event.m_phase, ts, m_pid, event.m_tid);
+    if (event.m_phase == 'X') {
+        double dur = (TscClock::TicksToNanos(event.m_end_ticks) -
+                      TscClock::TicksToNanos(event.m_begin_ticks)) /
+                     1000.0;
+        fprintf(m_file, ",\"dur\":%.3f", dur);
+    } else {
+        fputs(",\"s\":\"t\"", m_file);
+    }
+    if (event.m_arg_cnt > 0) {
+        fputs(",\"args\":{", m_file);
+        for (uint8_t i = 0; i < event.m_arg_cnt; ++i) {
+            fputs(i == 0 ? "\"" : ",\"", m_file);
+            WriteEscaped(m_file, event.m_arg_names[i]);
+            fprintf(m_file, "\":%lld",
+                    static_cast<long long>(event.m_arg_values[i]));  // NOLINT
+        }
+        fputc('}', m_file);
+    }
+    fputc('}', m_file);
+}
+
+}  // namespace cbase
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>  // NOLINT
+#include <cstdint>
+#include <cstdio>
+#include <mutex>  // NOLINT
+#include <string>
+#include <thread>  // NOLINT
+#include "thread_index.h"
+#include "tsc_clock.h"
+#include "utils.h"
+
+namespace cbase {
+
+// names must outlive the recorder, string literals in practice
+struct TraceEvent {
+    static constexpr int kMaxArgs = 2;
+
+    const char* m_name;
+    uint64_t m_begin_ticks;
+    uint64_t m_end_ticks;
+    const char* m_arg_names[kMaxArgs];
+    int64_t m_arg_values[kMaxArgs];
+    uint32_t m_tid;
+    char m_phase;  // 'X' span, 'i' instant
+    uint8_t m_arg_cnt;
+};
+
+// Records spans and instant events into per-thread rings, a flusher thread
+// writes them out as Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+// Recording takes no lock and allocates only the first time a thread
+// records. Events are dropped, and counted, when a ring is full or the
+// thread has no thread index for a ring.
+class TraceRecorder {
+public:
+    static constexpr uint32_t kRingSize = 4096;  // events per thread
+
+    static TraceRecorder& Instance();
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    void Enable() noexcept { m_enabled.store(true, std::memory_order_relaxed); }
+    void Disable() noexcept {
+        m_enabled.store(false, std::memory_order_relaxed);
+    }
+    bool IsEnabled() const noexcept {
+        return m_enabled.load(std::memory_order_relaxed);
+    }
+
+    // opens path and starts a thread flushing every interval_ms
+    bool Start(const std::string& path, int interval_ms = 100);
+    // flushes what is left and closes the JSON document
+    void Stop();
+    // drains every ring into the file now
+    void Flush();
+
+    void Record(const TraceEvent& event) noexcept;
+
+    uint64_t DroppedCount() const noexcept {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Ring {
+        std::atomic<uint64_t> m_head{0};
+        std::atomic<uint64_t> m_tail{0};
+        TraceEvent m_events[kRingSize];
+    };
+
+    TraceRecorder();
+    ~TraceRecorder() {}
+
+    Ring* CreateRing(uint32_t index) noexcept;
+    void Drain(Ring* ring);  // with m_mutex held
+    void Write(const TraceEvent& event);
+
+private:
+    std::atomic<bool> m_enabled;
+    std::atomic<bool> m_running;
+    std::atomic<uint64_t> m_dropped;
+    std::atomic<Ring*> m_rings[kMaxThreadIndex];
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::thread m_flusher;
+    FILE* m_file;
+    bool m_first_event;
+    int m_pid;
+};  // class TraceRecorder
+
+uint32_t TraceThreadId() noexcept;
+
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name) noexcept : m_arg_cnt(0) {
+        Begin(name);
+    }
+    TraceSpan(const char* name, const char* arg_name, int64_t value) noexcept
+        : m_arg_cnt(1) {
+        m_arg_names[0]  = arg_name;
+        m_arg_values[0] = value;
+        Begin(name);
+    }
+    TraceSpan(const char* name, const char* arg_name0, int64_t value0,
+              const char* arg_name1, int64_t value1) noexcept
+        : m_arg_cnt(2) {
+        m_arg_names[0]  = arg_name0;
+        m_arg_values[0] = value0;
+        m_arg_names[1]  = arg_name1;
+        m_arg_values[1] = value1;
+        Begin(name);
+    }
+
+    ~TraceSpan() {
+        if (m_name == nullptr) return;
+        TraceEvent event;
+        event.m_name        = m_name;
+        event.m_begin_ticks = m_begin_ticks;
+        event.m_end_ticks   = TscClock::NowTicks();
+        event.m_tid         = TraceThreadId();
+        event.m_phase       = 'X';
+        event.m_arg_cnt     = m_arg_cnt;
+        for (uint8_t i = 0; i < m_arg_cnt; ++i) {
+            event.m_arg_names[i]  = m_arg_names[i];
+            event.m_arg_values[i] = m_arg_values[i];
+        }
+        TraceRecorder::Instance().Record(event);
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    void Begin(const char* name) noexcept {
+        if (likely(!TraceRecorder::Instance().IsEnabled())) {
+            m_name = nullptr;
+            return;
+        }
+        m_name        = name;
+        m_begin_ticks = TscClock::NowTicks();
+    }
+
+    const char* m_name;
+    uint64_t m_begin_ticks;
+    uint8_t m_arg_cnt;
+    const char* m_arg_names[TraceEvent::kMaxArgs];
+    int64_t m_arg_values[TraceEvent::kMaxArgs];
+};  // class TraceSpan
+
+void TraceInstant(const char* name, const char* arg_name = nullptr,
+                  int64_t value = 0) noexcept;
+
+}  // namespace cbase
+
+#define CBASE_TRACE_CONCAT_IMPL(a, b) a##b
+#define CBASE_TRACE_CONCAT(a, b) CBASE_TRACE_CONCAT_IMPL(a, b)
+
+// define CBASE_TRACE_DISABLED to compile every trace point out
+#ifndef CBASE_TRACE_DISABLED
+#define CBASE_TRACE_SPAN(...) \
+    cbase::TraceSpan CBASE_TRACE_CONCAT(trace_span_, __LINE__)(__VA_ARGS__)
+#define CBASE_TRACE_INSTANT(...) cbase::TraceInstant(__VA_ARGS__)
+#else
+#define CBASE_TRACE_SPAN(...) \
+    do {                      \
+    } while (0)
+#define CBASE_TRACE_INSTANT(...) \
+    do {                         \
+    } while (0)
+#endif
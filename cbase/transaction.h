@@ -1,55 +1,97 @@
 #pragma once
 
 #include <cassert>
+#include <condition_variable>  // NOLINT
+#include <cstddef>
+#include <cstdint>
+#include <exception>
 #include <functional>
-#include <iostream>
 #include <list>
 #include <memory>
+#include <mutex>  // NOLINT
 #include <new>
 #include <string>
 #include <type_traits>
 #include <utility>
+#include <vector>
+#include "object_pool.h"
+#include "task.h"
+#include "thread_pool.h"
 
 namespace cbase {
 
+// bytes reserved inside a Procedure for the action and for the error func.
+// A bound object, member function and arguments that do not fit are moved
+// to the heap instead.
+constexpr std::size_t kProcedureInlineSize = 48;
+
+namespace detail {
+
+template <class F>
+class HeapCallable {
+public:
+    explicit HeapCallable(F&& func) : m_func(new F(std::move(func))) {}
+
+    auto operator()() -> decltype(std::declval<F&>()()) { return (*m_func)(); }
+
+private:
+    std::unique_ptr<F> m_func;
+};
+
+template <class Fn>
+struct FitsProcedure {
+    static constexpr bool value =
+        sizeof(Fn) <= kProcedureInlineSize &&
+        alignof(Fn) <= alignof(std::max_align_t);
+};
+
+// inline as long as it fits, that is the usual case and never allocates
+template <class F, class Fn = typename std::decay<F>::type>
+typename std::enable_if<FitsProcedure<Fn>::value, Fn>::type
+ProcedureCallable(F&& func) {
+    return Fn(std::forward<F>(func));
+}
+
+template <class F, class Fn = typename std::decay<F>::type>
+typename std::enable_if<!FitsProcedure<Fn>::value, HeapCallable<Fn>>::type
+ProcedureCallable(F&& func) {
+    return HeapCallable<Fn>(Fn(std::forward<F>(func)));
+}
+
+}  // namespace detail
+
 class Procedure {
 public:
-    explicit Procedure(const std::function<bool()>& action_func)
+    template <class F, class = typename std::enable_if<!std::is_same<
+                           typename std::decay<F>::type,
+                           Procedure>::value>::type>
+    explicit Procedure(F&& action_func)
         : m_commited(false),
-          m_action_func(action_func),
-          m_error_func(nullptr) {}
+          m_index(0),
+          m_depends(0),
+          m_action_func(detail::ProcedureCallable(
+              std::forward<F>(action_func))) {}
 
-    ~Procedure() {
-        // TODO(adaiboy): Warning here, as m_error_func may raise exception
-        // and this will make process terminate
-        if (!m_commited && m_error_func != nullptr) {
-            m_error_func();
-        }
-    }
+    ~Procedure() { Rollback(nullptr); }
 
-    Procedure(const Procedure& other)
-        : m_commited(other.m_commited),
-          m_action_func(other.m_action_func),
-          m_error_func(other.m_error_func) {}
-
-    Procedure& operator=(const Procedure& other) {
-        if (this == &other) return *this;
-        m_commited    = other.m_commited;
-        m_action_func = other.m_action_func;
-        m_error_func  = other.m_error_func;
-        return *this;
-    }
+    // a copy would run the same rollback twice, so Procedure is move only
+    Procedure(const Procedure&) = delete;
+    Procedure& operator=(const Procedure&) = delete;
 
-    Procedure(Procedure&& other)
+    Procedure(Procedure&& other) noexcept
         : m_commited(other.m_commited),
+          m_index(other.m_index),
+          m_depends(other.m_depends),
           m_action_func(std::move(other.m_action_func)),
           m_error_func(std::move(other.m_error_func)) {
         other.m_commited = true;
     }
 
-    Procedure& operator=(Procedure&& other) {
+    Procedure& operator=(Procedure&& other) noexcept {
         m_commited       = other.m_commited;
         other.m_commited = true;
+        m_index          = other.m_index;
+        m_depends        = other.m_depends;
         m_action_func    = std::move(other.m_action_func);
         m_error_func     = std::move(other.m_error_func);
         return *this;
@@ -59,22 +101,63 @@ public:
     // is longer than procedure
     template <typename Obj, typename MemFun, typename... Args>
     void AddErrorFunc(Obj* obj, MemFun memfun, Args&&... args) {
-        m_error_func = std::bind(memfun, obj, std::forward<Args>(args)...);
+        m_error_func = detail::ProcedureCallable(
+            std::bind(memfun, obj, std::forward<Args>(args)...));
+    }
+
+    // this procedure is only invoked after other succeeded, other must be
+    // added to the same transaction before this one
+    Procedure& DependsOn(const Procedure& other) noexcept {
+        assert(other.m_index < m_index && "depend on a later procedure.");
+        assert(other.m_index < 64 && "too many procedures to depend on.");
+        m_depends |= uint64_t(1) << other.m_index;
+        return *this;
     }
 
     bool Invoke() { return m_action_func(); }
     void Commit() noexcept { m_commited = true; }
 
+    // runs the error func once if not commited, exception raised by it is
+    // reported through err_msg instead of escaping
+    bool Rollback(std::string* err_msg) noexcept {
+        if (m_commited) return true;
+        m_commited = true;
+        if (!m_error_func) return true;
+        try {
+            m_error_func();
+            return true;
+        } catch (const std::exception& e) {
+            if (err_msg != nullptr) *err_msg = e.what();
+        } catch (...) {
+            if (err_msg != nullptr) *err_msg = "unknown exception";
+        }
+        return false;
+    }
+
 private:
+    template <typename, std::size_t>
+    friend class Transaction;
+
     bool m_commited;
-    std::function<bool()> m_action_func;
-    std::function<void()> m_error_func;
+    uint32_t m_index;
+    uint64_t m_depends;  // bit i set if depends on procedure i
+    task<bool(), kProcedureInlineSize> m_action_func;
+    task<void(), kProcedureInlineSize> m_error_func;
 };  // class Procedure
 
-template <typename T>
+// The first N procedures live inside the Transaction itself, only longer
+// transactions spill the extra steps to the heap.
+//
+// Procedures not commited are rolled back in reverse order of addition.
+// As a procedure may only depend on earlier ones, that is also a reverse
+// topological order of the dependency graph.
+template <typename T, std::size_t N = 8>
 class Transaction {
 public:
-    Transaction() {}
+    // dependencies are kept as a bit mask
+    static constexpr std::size_t kMaxParallelProcedures = 64;
+
+    Transaction() : m_size(0) {}
     ~Transaction();
 
     Transaction(const Transaction&) = delete;
@@ -87,6 +170,15 @@ public:
 
     bool InvokeCurrentProcedures();
 
+    // invokes procedures on pool as soon as their dependencies succeeded,
+    // nothing new is launched after the first failure. Returns once every
+    // launched procedure finished.
+    bool InvokeCurrentProcedures(ThreadPool* pool);
+
+    // rolls back every procedure not commited yet, errors are collected
+    // into GetRollbackErrors(). Called by the destructor if not done before.
+    bool Rollback() noexcept;
+
     // TODO(adaiboy): warning we cannot assume obj's lifetime
     // is longer than transaction
     template <class Obj, typename MemFun, typename... Args>
@@ -94,22 +186,57 @@ public:
 
     std::string GetErrMsg() const noexcept { return m_err_msg; }
 
+    const std::vector<std::string>& GetRollbackErrors() const noexcept {
+        return m_rollback_errors;
+    }
+
+    std::size_t size() const noexcept { return m_size + m_overflow.size(); }
+
+private:
+    Procedure& At(std::size_t idx) noexcept {
+        return *reinterpret_cast<Procedure*>(&m_procedures[idx]);
+    }
+
+    struct ParallelState {
+        std::mutex m_mutex;
+        std::condition_variable m_cond;
+        Procedure* m_steps[kMaxParallelProcedures];
+        std::size_t m_cnt      = 0;
+        std::size_t m_running  = 0;
+        uint64_t m_launched    = 0;
+        uint64_t m_succeeded   = 0;
+        bool m_failed          = false;
+        std::string m_err_msg;
+    };
+
+    static void LaunchReady(ParallelState* state, ThreadPool* pool);
+    static void RunStep(ParallelState* state, ThreadPool* pool,
+                        std::size_t idx);
+
 private:
-    std::list<Procedure> m_procedures;
+    typename std::aligned_storage<sizeof(Procedure), alignof(Procedure)>::type
+        m_procedures[N];
+    std::size_t m_size;
+    std::list<Procedure, pool_allocator<Procedure>> m_overflow;
     std::string m_err_msg;
+    std::vector<std::string> m_rollback_errors;
 };  // class Transaction
 
-template <typename T>
-Transaction<T>::~Transaction() {
-    while (!m_procedures.empty()) {
-        m_procedures.pop_back();
+template <typename T, std::size_t N>
+Transaction<T, N>::~Transaction() {
+    Rollback();
+    while (!m_overflow.empty()) {
+        m_overflow.pop_back();
+    }
+    while (m_size > 0) {
+        At(--m_size).~Procedure();
     }
 }
 
-template <typename T>
+template <typename T, std::size_t N>
 template <class Obj, typename MemFun, typename... Args>
-Procedure& Transaction<T>::AddProcedure(Obj* obj, MemFun memfun,
-                                        Args&&... args) {
+Procedure& Transaction<T, N>::AddProcedure(Obj* obj, MemFun memfun,
+                                           Args&&... args) {
     // (obj.*memfun)(std::forward<Args>(args)...);
     // decltype((std::declval<Obj>().*memfun)(std::forward<Args>(args)...)) a;
     static_assert(std::is_same<decltype((std::declval<Obj>().*
@@ -119,26 +246,147 @@ Procedure& Transaction<T>::AddProcedure(Obj* obj, MemFun memfun,
     static_assert(std::is_same<T, typename std::remove_cv<Obj>::type>::value,
                   "T and Obj should be same type");
 
-    std::function<bool()> action_func =
-        std::bind(memfun, obj, std::forward<Args>(args)...);
-    Procedure procedure(action_func);
-    // move procedure into list
-    m_procedures.emplace_back(std::move(procedure));
-    return m_procedures.back();
+    uint32_t index   = static_cast<uint32_t>(size());
+    auto action_func = std::bind(memfun, obj, std::forward<Args>(args)...);
+    Procedure* procedure = nullptr;
+    if (m_size < N) {
+        procedure =
+            new (&m_procedures[m_size]) Procedure(std::move(action_func));
+        ++m_size;
+    } else {
+        m_overflow.emplace_back(std::move(action_func));
+        procedure = &m_overflow.back();
+    }
+    procedure->m_index = index;
+    return *procedure;
 }
 
-template <typename T>
-bool Transaction<T>::InvokeCurrentProcedures() {
-    for (auto& procedure : m_procedures) {
+template <typename T, std::size_t N>
+bool Transaction<T, N>::InvokeCurrentProcedures() {
+    for (std::size_t i = 0; i < m_size; ++i) {
+        if (!At(i).Invoke()) {
+            return false;
+        }
+    }
+    for (auto& procedure : m_overflow) {
         if (!procedure.Invoke()) {
             return false;
         }
     }
 
-    for (auto& procedure : m_procedures) {
+    for (std::size_t i = 0; i < m_size; ++i) {
+        At(i).Commit();
+    }
+    for (auto& procedure : m_overflow) {
         procedure.Commit();
     }
     return true;
 }
 
+template <typename T, std::size_t N>
+bool Transaction<T, N>::InvokeCurrentProcedures(ThreadPool* pool) {
+    if (size() > kMaxParallelProcedures) {
+        m_err_msg = "too many procedures for parallel invoke.";
+        return false;
+    }
+
+    ParallelState state;
+    for (std::size_t i = 0; i < m_size; ++i) {
+        state.m_steps[state.m_cnt++] = &At(i);
+    }
+    for (auto& procedure : m_overflow) {
+        state.m_steps[state.m_cnt++] = &procedure;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(state.m_mutex);
+        LaunchReady(&state, pool);
+        state.m_cond.wait(lock, [&state] { return state.m_running == 0; });
+    }
+
+    if (state.m_failed) {
+        m_err_msg = state.m_err_msg;
+        return false;
+    }
+    for (std::size_t i = 0; i < state.m_cnt; ++i) {
+        state.m_steps[i]->Commit();
+    }
+    return true;
+}
+
+// must be called with state->m_mutex held
+template <typename T, std::size_t N>
+void Transaction<T, N>::LaunchReady(ParallelState* state, ThreadPool* pool) {
+    if (state->m_failed) return;
+    for (std::size_t i = 0; i < state->m_cnt; ++i) {
+        uint64_t bit = uint64_t(1) << i;
+        if (state->m_launched & bit) continue;
+        uint64_t depends = state->m_steps[i]->m_depends;
+        if ((depends & state->m_succeeded) != depends) continue;
+
+        state->m_launched |= bit;
+        ++state->m_running;
+        pool->Submit([state, pool, i] { RunStep(state, pool, i); });
+    }
+}
+
+template <typename T, std::size_t N>
+void Transaction<T, N>::RunStep(ParallelState* state, ThreadPool* pool,
+                                std::size_t idx) {
+    bool ok = false;
+    std::string err_msg;
+    try {
+        ok = state->m_steps[idx]->Invoke();
+        if (!ok) err_msg = "procedure failed.";
+    } catch (const std::exception& e) {
+        err_msg = e.what();
+    } catch (...) {
+        err_msg = "unknown exception";
+    }
+
+    std::lock_guard<std::mutex> lock(state->m_mutex);
+    if (ok) {
+        state->m_succeeded |= uint64_t(1) << idx;
+        LaunchReady(state, pool);
+    } else if (!state->m_failed) {
+        state->m_failed  = true;
+        state->m_err_msg = std::move(err_msg);
+    }
+    // notify under lock, the waiter owns state and may destroy it as soon
+    // as it sees m_running reach zero
+    if (--state->m_running == 0) state->m_cond.notify_all();
+}
+
+template <typename T, std::size_t N>
+bool Transaction<T, N>::Rollback() noexcept {
+    // room for an error per procedure up front, so no push_back below can
+    // throw. Without the memory every procedure still rolls back, only
+    // errors past the capacity are not kept.
+    try {
+        m_rollback_errors.reserve(m_rollback_errors.size() + size());
+    } catch (...) {
+    }
+    auto add_error = [this](std::string* err_msg) {
+        if (m_rollback_errors.size() < m_rollback_errors.capacity()) {
+            m_rollback_errors.push_back(std::move(*err_msg));
+        }
+    };
+
+    bool ok = true;
+    std::string err_msg;
+    for (auto it = m_overflow.rbegin(); it != m_overflow.rend(); ++it) {
+        if (!it->Rollback(&err_msg)) {
+            ok = false;
+            add_error(&err_msg);
+        }
+    }
+    for (std::size_t i = m_size; i > 0; --i) {
+        if (!At(i - 1).Rollback(&err_msg)) {
+            ok = false;
+            add_error(&err_msg);
+        }
+    }
+    return ok;
+}
+
 }  // namespace cbase
@@ -0,0 +1,123 @@
+// Compares the inline Transaction against the previous std::list +
+// std::function implementation, counting heap allocations per transaction.
+// g++ -std=c++11 -O2 transaction_bench.cpp -o transaction_bench
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <list>
+#include <new>
+#include "chrono_time_elapser.h"
+#include "transaction.h"
+
+static std::atomic<uint64_t> g_allocs(0);
+
+void* operator new(std::size_t size) {
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    void* ptr = malloc(size);
+    if (ptr == nullptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { free(ptr); }
+
+namespace legacy {
+
+class Procedure {
+public:
+    explicit Procedure(const std::function<bool()>& action_func)
+        : m_commited(false), m_action_func(action_func) {}
+    ~Procedure() {
+        if (!m_commited && m_error_func != nullptr) m_error_func();
+    }
+
+    template <typename Obj, typename MemFun, typename... Args>
+    void AddErrorFunc(Obj* obj, MemFun memfun, Args&&... args) {
+        m_error_func = std::bind(memfun, obj, std::forward<Args>(args)...);
+    }
+
+    bool Invoke() { return m_action_func(); }
+    void Commit() noexcept { m_commited = true; }
+
+private:
+    bool m_commited;
+    std::function<bool()> m_action_func;
+    std::function<void()> m_error_func;
+};
+
+template <typename T>
+class Transaction {
+public:
+    ~Transaction() {
+        while (!m_procedures.empty()) m_procedures.pop_back();
+    }
+
+    template <class Obj, typename MemFun, typename... Args>
+    Procedure& AddProcedure(Obj* obj, MemFun memfun, Args&&... args) {
+        std::function<bool()> action_func =
+            std::bind(memfun, obj, std::forward<Args>(args)...);
+        m_procedures.emplace_back(action_func);
+        return m_procedures.back();
+    }
+
+    bool InvokeCurrentProcedures() {
+        for (auto& procedure : m_procedures) {
+            if (!procedure.Invoke()) return false;
+        }
+        for (auto& procedure : m_procedures) procedure.Commit();
+        return true;
+    }
+
+private:
+    std::list<Procedure> m_procedures;
+};
+
+}  // namespace legacy
+
+class Store {
+public:
+    bool Put(int key, int64_t value, int64_t version) {
+        m_sum += key + value + version;
+        return true;
+    }
+    void Undo(int key, int64_t value) { m_sum -= key + value; }
+
+    int64_t m_sum = 0;
+};
+
+template <class Txn>
+static void RunTxn(Store* store, int i, int steps) {
+    Txn txn;
+    for (int s = 0; s < steps; ++s) {
+        auto& procedure = txn.AddProcedure(store, &Store::Put, s, i, i + 1);
+        procedure.AddErrorFunc(store, &Store::Undo, s, i);
+    }
+    txn.InvokeCurrentProcedures();
+}
+
+template <class Txn>
+static void Bench(const char* name, int loops, int steps) {
+    Store store;
+    uint64_t allocs_before = g_allocs.load();
+    cbase::ChronoTimeElapser elapser;
+    for (int i = 0; i < loops; ++i) {
+        RunTxn<Txn>(&store, i, steps);
+    }
+    uint64_t micros = elapser.ElapsedTime();
+    uint64_t allocs = g_allocs.load() - allocs_before;
+    printf("%-8s steps=%d  %8.1f ns/txn  %5.2f allocs/txn  (sum %lld)\n",
+           name, steps, micros * 1000.0 / loops,
+           static_cast<double>(allocs) / loops,
+           static_cast<long long>(store.m_sum));  // NOLINT
+}
+
+int main(int argc, char** argv) {
+    int loops = argc > 1 ? atoi(argv[1]) : 1000000;
+    for (int steps : {3, 6, 12}) {
+        Bench<legacy::Transaction<Store>>("legacy", loops, steps);
+        Bench<cbase::Transaction<Store>>("inline", loops, steps);
+    }
+    return 0;
+}
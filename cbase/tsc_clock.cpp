@@ -0,0 +1,81 @@
+#include "tsc_clock.h"
+
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+namespace cbase {
+
+namespace {
+
+constexpr uint64_t kNanosPerSecond = 1000000000;
+constexpr uint64_t kCalibrateNanos = 10000000;  // 10ms
+
+bool HasInvariantTsc() {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    if (__get_cpuid_max(0x80000000, nullptr) < 0x80000007) return false;
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx & (1u << 8)) != 0;
+#else
+    return false;
+#endif
+}
+
+uint64_t MonotonicRawNanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * kNanosPerSecond + ts.tv_nsec;
+}
+
+// reads the tsc and the raw clock as close together as possible, the
+// pair with the shortest read window of a few tries wins
+void ReadPair(uint64_t* tsc, uint64_t* nanos) {
+    uint64_t best = ~uint64_t(0);
+    for (int i = 0; i < 5; ++i) {
+        uint64_t before = TscClock::Rdtscp();
+        uint64_t ns     = MonotonicRawNanos();
+        uint64_t after  = TscClock::Rdtscp();
+        if (after - before < best) {
+            best   = after - before;
+            *tsc   = before + (after - before) / 2;
+            *nanos = ns;
+        }
+    }
+}
+
+// the calibration busy-waits, keep it off the first NowNanos call, which
+// is usually on a latency sensitive path
+struct CalibrationPrimer {
+    CalibrationPrimer() { TscClock::Init(); }
+};
+static CalibrationPrimer s_calibration_primer;
+
+}  // namespace
+
+TscClock::Calibration TscClock::Calibrate() noexcept {
+    Calibration calibration = {false, kNanosPerSecond, uint64_t(1) << kShift};
+    if (!HasInvariantTsc()) return calibration;
+
+    uint64_t tsc_begin = 0, ns_begin = 0, tsc_end = 0, ns_end = 0;
+    ReadPair(&tsc_begin, &ns_begin);
+    do {
+        ReadPair(&tsc_end, &ns_end);
+    } while (ns_end - ns_begin < kCalibrateNanos);
+
+    uint64_t ticks = tsc_end - tsc_begin;
+    uint64_t nanos = ns_end - ns_begin;
+    uint64_t hz    = static_cast<uint64_t>(
+        static_cast<unsigned __int128>(ticks) * kNanosPerSecond / nanos);
+    // anything outside 100MHz..100GHz means the tsc cannot be trusted
+    if (hz < 100000000ull || hz > 100000000000ull) return calibration;
+
+    calibration.m_reliable      = true;
+    calibration.m_ticks_per_sec = hz;
+    calibration.m_mult          = static_cast<uint64_t>(
+        (static_cast<unsigned __int128>(kNanosPerSecond) << kShift) / hz);
+    return calibration;
+}
+
+}  // namespace cbase
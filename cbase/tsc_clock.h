@@ -0,0 +1,98 @@
+#pragma once
+
+#include <chrono>  // NOLINT
+#include <cstdint>
+
+namespace cbase {
+
+// TSC based clock, calibrated once against CLOCK_MONOTONIC_RAW. Ticks are
+// turned into nanoseconds with a fixed point multiply-shift, so there is no
+// division nor overflow on the read path. When the CPU has no invariant TSC
+// the clock falls back to steady_clock, the same clock ChronoTimeElapser
+// uses.
+class TscClock {
+public:
+    // plain rdtsc, may be reordered with surrounding instructions
+    static uint64_t Rdtsc() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+        uint32_t lo, hi;
+        __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+        return (static_cast<uint64_t>(hi) << 32) | lo;
+#else
+        return SteadyNanos();
+#endif
+    }
+
+    // waits for earlier instructions to retire before reading
+    static uint64_t Rdtscp() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+        uint32_t lo, hi;
+        __asm__ volatile("rdtscp" : "=a"(lo), "=d"(hi) : : "rcx");
+        return (static_cast<uint64_t>(hi) << 32) | lo;
+#else
+        return SteadyNanos();
+#endif
+    }
+
+    // lfence keeps later instructions from starting before the read
+    static uint64_t RdtscLfence() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+        uint32_t lo, hi;
+        __asm__ volatile("lfence\n\trdtsc" : "=a"(lo), "=d"(hi) : : "memory");
+        return (static_cast<uint64_t>(hi) << 32) | lo;
+#else
+        return SteadyNanos();
+#endif
+    }
+
+    // runs the 10ms calibration now. This happens at static init already,
+    // only code running before that, e.g. another static initializer, may
+    // want to call it off its hot path.
+    static void Init() noexcept { Get(); }
+
+    // invariant TSC and a sane calibration
+    static bool IsReliable() noexcept { return Get().m_reliable; }
+    static uint64_t TicksPerSecond() noexcept { return Get().m_ticks_per_sec; }
+
+    static uint64_t TicksToNanos(uint64_t ticks) noexcept {
+        const Calibration& calibration = Get();
+        return static_cast<uint64_t>(
+            (static_cast<unsigned __int128>(ticks) * calibration.m_mult) >>
+            kShift);
+    }
+
+    // cheapest monotonic stamp, turn it into time with TicksToNanos. Falls
+    // back to nanoseconds, for which the calibration is the identity.
+    static uint64_t NowTicks() noexcept {
+        return IsReliable() ? Rdtscp() : SteadyNanos();
+    }
+
+    // nanoseconds on a monotonic time line
+    static uint64_t NowNanos() noexcept {
+        return IsReliable() ? TicksToNanos(Rdtscp()) : SteadyNanos();
+    }
+
+    static uint64_t SteadyNanos() noexcept {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+private:
+    static constexpr uint32_t kShift = 32;
+
+    struct Calibration {
+        bool m_reliable;
+        uint64_t m_ticks_per_sec;
+        uint64_t m_mult;  // nanos = ticks * m_mult >> kShift
+    };
+
+    static const Calibration& Get() noexcept {
+        static const Calibration calibration = Calibrate();
+        return calibration;
+    }
+
+    static Calibration Calibrate() noexcept;
+};  // class TscClock
+
+}  // namespace cbase
@@ -0,0 +1,277 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include "epoch_reclaimer.h"
+
+namespace cbase {
+
+// Unbounded MPMC queue with the push/pop interface of lockfree_queue, push
+// never fails. Items live in linked segments of SegmentSize cells.
+// Producers and consumers claim a cell with one fetch_add on the segment's
+// enqueue/dequeue index. A consumer that overtakes a slow producer poisons
+// the cell and the producer retries in another one. Drained segments are
+// retired through an EpochReclaimer and then kept on a free list for
+// reuse, so steady traffic stops allocating.
+template <class Data, std::size_t SegmentSize = 1024>
+class unbounded_lockfree_queue {
+    static_assert(SegmentSize >= 2, "segment is too small");
+
+public:
+    unbounded_lockfree_queue();
+    ~unbounded_lockfree_queue();
+
+    unbounded_lockfree_queue(const unbounded_lockfree_queue&) = delete;
+    unbounded_lockfree_queue& operator=(const unbounded_lockfree_queue&) =
+        delete;
+
+    int push(const Data& data);
+    int push(Data&& data);
+    int pop(Data& data);  // NOLINT
+
+    // approximate, poisoned cells are counted as items
+    size_t size() const;
+
+private:
+    static constexpr uint32_t kEmpty    = 0;
+    static constexpr uint32_t kFull     = 1;
+    static constexpr uint32_t kPoisoned = 2;
+    // how long pop waits on a claimed but unwritten cell before poisoning
+    static constexpr int kPoisonSpins = 128;
+    static constexpr size_t kMaxFreeSegments = 8;
+
+    struct Cell {
+        std::atomic<uint32_t> m_state{kEmpty};
+        Data m_data;
+    };
+
+    struct Segment {
+        std::atomic<uint64_t> m_enq_idx{0};
+        char m_enq_padding[64];
+        std::atomic<uint64_t> m_deq_idx{0};
+        char m_deq_padding[64];
+        std::atomic<Segment*> m_next{nullptr};
+        uint64_t m_id         = 0;  // position in the chain, for size()
+        Segment* m_free_next = nullptr;
+        std::array<Cell, SegmentSize> m_cells;
+    };
+
+    template <class D>
+    int push_impl(D&& data);
+
+    // undoes the move of a push whose cell was poisoned
+    static void TakeBack(const Data&, Data&) noexcept {}
+    static void TakeBack(Data& data, Data& cell) { data = std::move(cell); }
+
+    Segment* AcquireSegment(uint64_t id);
+    void ReleaseSegment(Segment* segment) noexcept;
+    static void RecycleSegment(void* ptr, void* ctx) {
+        static_cast<unbounded_lockfree_queue*>(ctx)->ReleaseSegment(
+            static_cast<Segment*>(ptr));
+    }
+
+private:
+    std::atomic<Segment*> m_head;
+    char m_head_padding[64];
+    std::atomic<Segment*> m_tail;
+    char m_tail_padding[64];
+    std::atomic<Segment*> m_free_segments;
+    std::atomic<size_t> m_free_cnt;
+    mutable EpochReclaimer m_reclaimer;
+};
+
+template <class Data, std::size_t SegmentSize>
+unbounded_lockfree_queue<Data, SegmentSize>::unbounded_lockfree_queue()
+    : m_free_segments(nullptr), m_free_cnt(0) {
+    Segment* segment = new Segment();
+    m_head.store(segment, std::memory_order_relaxed);
+    m_tail.store(segment, std::memory_order_relaxed);
+}
+
+template <class Data, std::size_t SegmentSize>
+unbounded_lockfree_queue<Data, SegmentSize>::~unbounded_lockfree_queue() {
+    m_reclaimer.ReclaimAll();
+    Segment* segment = m_head.load(std::memory_order_relaxed);
+    while (segment != nullptr) {
+        Segment* next = segment->m_next.load(std::memory_order_relaxed);
+        delete segment;
+        segment = next;
+    }
+    segment = m_free_segments.load(std::memory_order_relaxed);
+    while (segment != nullptr) {
+        Segment* next = segment->m_free_next;
+        delete segment;
+        segment = next;
+    }
+}
+
+template <class Data, std::size_t SegmentSize>
+int unbounded_lockfree_queue<Data, SegmentSize>::push(const Data& data) {
+    return push_impl(data);
+}
+
+template <class Data, std::size_t SegmentSize>
+int unbounded_lockfree_queue<Data, SegmentSize>::push(Data&& data) {
+    return push_impl(std::move(data));
+}
+
+template <class Data, std::size_t SegmentSize>
+template <class D>
+int unbounded_lockfree_queue<Data, SegmentSize>::push_impl(D&& data) {
+    EpochReclaimer::Guard guard(&m_reclaimer);
+    while (true) {
+        Segment* segment = m_tail.load(std::memory_order_acquire);
+        uint64_t idx =
+            segment->m_enq_idx.fetch_add(1, std::memory_order_relaxed);
+        if (idx < SegmentSize) {
+            Cell& cell = segment->m_cells[idx];
+            if (cell.m_state.load(std::memory_order_relaxed) != kEmpty) {
+                continue;
+            }
+            cell.m_data       = std::forward<D>(data);
+            uint32_t expected = kEmpty;
+            if (cell.m_state.compare_exchange_strong(
+                    expected, kFull, std::memory_order_release,
+                    std::memory_order_relaxed)) {
+                return 0;
+            }
+            TakeBack(data, cell.m_data);
+            continue;
+        }
+
+        // segment is full, link a new one with our data in its first cell
+        Segment* next = segment->m_next.load(std::memory_order_acquire);
+        if (next == nullptr) {
+            Segment* fresh = AcquireSegment(segment->m_id + 1);
+            fresh->m_enq_idx.store(1, std::memory_order_relaxed);
+            fresh->m_cells[0].m_data = std::forward<D>(data);
+            fresh->m_cells[0].m_state.store(kFull, std::memory_order_relaxed);
+            if (segment->m_next.compare_exchange_strong(
+                    next, fresh, std::memory_order_release,
+                    std::memory_order_acquire)) {
+                m_tail.compare_exchange_strong(segment, fresh,
+                                               std::memory_order_release,
+                                               std::memory_order_relaxed);
+                return 0;
+            }
+            // lost the race, fresh was never visible to anyone
+            TakeBack(data, fresh->m_cells[0].m_data);
+            ReleaseSegment(fresh);
+        }
+        m_tail.compare_exchange_strong(segment, next,
+                                       std::memory_order_release,
+                                       std::memory_order_relaxed);
+    }
+}
+
+template <class Data, std::size_t SegmentSize>
+int unbounded_lockfree_queue<Data, SegmentSize>::pop(Data& data) {  // NOLINT
+    EpochReclaimer::Guard guard(&m_reclaimer);
+    while (true) {
+        Segment* segment = m_head.load(std::memory_order_acquire);
+        uint64_t deq     = segment->m_deq_idx.load(std::memory_order_relaxed);
+        uint64_t enq     = segment->m_enq_idx.load(std::memory_order_relaxed);
+        Segment* next    = segment->m_next.load(std::memory_order_acquire);
+        if (deq >= enq && next == nullptr) return -1;
+
+        uint64_t idx =
+            segment->m_deq_idx.fetch_add(1, std::memory_order_relaxed);
+        if (idx >= SegmentSize) {
+            next = segment->m_next.load(std::memory_order_acquire);
+            if (next == nullptr) return -1;
+            // tail must not point at a retired segment
+            Segment* tail = segment;
+            m_tail.compare_exchange_strong(tail, next,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed);
+            if (m_head.compare_exchange_strong(segment, next,
+                                               std::memory_order_release,
+                                               std::memory_order_relaxed)) {
+                m_reclaimer.Retire(segment, &RecycleSegment, this);
+            }
+            continue;
+        }
+
+        Cell& cell     = segment->m_cells[idx];
+        uint32_t state = cell.m_state.load(std::memory_order_acquire);
+        for (int spin = 0; state == kEmpty && spin < kPoisonSpins; ++spin) {
+            state = cell.m_state.load(std::memory_order_acquire);
+        }
+        if (state == kEmpty &&
+            cell.m_state.compare_exchange_strong(state, kPoisoned,
+                                                 std::memory_order_acquire,
+                                                 std::memory_order_acquire)) {
+            continue;
+        }
+        data = std::move(cell.m_data);
+        return 0;
+    }
+}
+
+template <class Data, std::size_t SegmentSize>
+size_t unbounded_lockfree_queue<Data, SegmentSize>::size() const {
+    EpochReclaimer::Guard guard(&m_reclaimer);
+    const Segment* head = m_head.load(std::memory_order_acquire);
+    const Segment* tail = m_tail.load(std::memory_order_acquire);
+    uint64_t deq = head->m_deq_idx.load(std::memory_order_relaxed);
+    uint64_t enq = tail->m_enq_idx.load(std::memory_order_relaxed);
+    if (deq > SegmentSize) deq = SegmentSize;
+    if (enq > SegmentSize) enq = SegmentSize;
+    deq += head->m_id * SegmentSize;
+    enq += tail->m_id * SegmentSize;
+    return enq > deq ? static_cast<size_t>(enq - deq) : 0;
+}
+
+// the free list is only pushed with CAS and emptied with exchange, so no
+// ABA; the rest of a taken list is pushed back
+template <class Data, std::size_t SegmentSize>
+typename unbounded_lockfree_queue<Data, SegmentSize>::Segment*
+unbounded_lockfree_queue<Data, SegmentSize>::AcquireSegment(uint64_t id) {
+    Segment* segment =
+        m_free_segments.exchange(nullptr, std::memory_order_acquire);
+    if (segment == nullptr) {
+        segment = new Segment();
+    } else {
+        m_free_cnt.fetch_sub(1, std::memory_order_relaxed);
+        Segment* rest = segment->m_free_next;
+        if (rest != nullptr) {
+            Segment* last = rest;
+            while (last->m_free_next != nullptr) last = last->m_free_next;
+            Segment* head = m_free_segments.load(std::memory_order_relaxed);
+            do {
+                last->m_free_next = head;
+            } while (!m_free_segments.compare_exchange_weak(
+                head, rest, std::memory_order_release,
+                std::memory_order_relaxed));
+        }
+        segment->m_enq_idx.store(0, std::memory_order_relaxed);
+        segment->m_deq_idx.store(0, std::memory_order_relaxed);
+        segment->m_next.store(nullptr, std::memory_order_relaxed);
+        for (auto& cell : segment->m_cells) {
+            cell.m_state.store(kEmpty, std::memory_order_relaxed);
+        }
+    }
+    segment->m_id        = id;
+    segment->m_free_next = nullptr;
+    return segment;
+}
+
+template <class Data, std::size_t SegmentSize>
+void unbounded_lockfree_queue<Data, SegmentSize>::ReleaseSegment(
+    Segment* segment) noexcept {
+    if (m_free_cnt.load(std::memory_order_relaxed) >= kMaxFreeSegments) {
+        delete segment;
+        return;
+    }
+    m_free_cnt.fetch_add(1, std::memory_order_relaxed);
+    Segment* head = m_free_segments.load(std::memory_order_relaxed);
+    do {
+        segment->m_free_next = head;
+    } while (!m_free_segments.compare_exchange_weak(
+        head, segment, std::memory_order_release, std::memory_order_relaxed));
+}
+
+}  // namespace cbase
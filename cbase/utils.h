@@ -7,3 +7,13 @@
 #define likely(x) (x)
 #define unlikely(x) (x)
 #endif
+
+// hint for spin-wait loops, lets the sibling hyperthread run and avoids
+// the memory order violation flush when the loop exits
+inline void cpu_relax() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
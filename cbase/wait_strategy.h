@@ -0,0 +1,144 @@
+#pragma once
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>  // NOLINT
+#include <cstdint>
+#include <thread>  // NOLINT
+#include "utils.h"
+
+namespace cbase {
+
+// Wait strategies for the blocking calls of lockfree_queue, picking one
+// trades latency against cpu:
+//   busy_spin_wait   pause loop, lowest latency, keeps a core busy
+//   spin_yield_wait  spins for a while, then yields between checks
+//   park_wait        spins for a while, then sleeps on a futex
+//   timed_wait       spins for a while, then sleeps in growing steps
+//
+// wait(ready, deadline) returns true once ready() holds and false if the
+// deadline passed first. notify() is called after every change that may
+// make a waiter ready; only park_wait needs it, and it makes the syscall
+// only when a waiter is actually parked.
+using wait_clock = std::chrono::steady_clock;
+
+class busy_spin_wait {
+public:
+    template <class Ready>
+    bool wait(Ready ready, wait_clock::time_point deadline) {
+        for (uint32_t spins = 1;; ++spins) {
+            if (ready()) return true;
+            // a clock read costs more than a pause
+            if ((spins & 0xff) == 0 && wait_clock::now() >= deadline) {
+                return ready();
+            }
+            cpu_relax();
+        }
+    }
+
+    void notify() noexcept {}
+};
+
+template <uint32_t Spins = 1024>
+class spin_yield_wait {
+public:
+    template <class Ready>
+    bool wait(Ready ready, wait_clock::time_point deadline) {
+        for (uint32_t spins = 1;; ++spins) {
+            if (ready()) return true;
+            if (spins < Spins) {
+                cpu_relax();
+                continue;
+            }
+            if (wait_clock::now() >= deadline) return ready();
+            std::this_thread::yield();
+        }
+    }
+
+    void notify() noexcept {}
+};
+
+// Sleeps start at 1us and double up to MaxSleepUs, so an idle waiter costs
+// little and a busy one still reacts within MaxSleepUs.
+template <uint32_t Spins = 1024, uint32_t MaxSleepUs = 1000>
+class timed_wait {
+public:
+    template <class Ready>
+    bool wait(Ready ready, wait_clock::time_point deadline) {
+        for (uint32_t spins = 0; spins < Spins; ++spins) {
+            if (ready()) return true;
+            cpu_relax();
+        }
+        uint32_t sleep_us = 1;
+        while (!ready()) {
+            wait_clock::time_point now = wait_clock::now();
+            if (now >= deadline) return ready();
+            wait_clock::time_point until =
+                now + std::chrono::microseconds(sleep_us);
+            std::this_thread::sleep_until(until < deadline ? until : deadline);
+            if (sleep_us < MaxSleepUs) sleep_us *= 2;
+        }
+        return true;
+    }
+
+    void notify() noexcept {}
+};
+
+// A waiter announces itself in m_waiters and checks ready() again before
+// it sleeps on m_seq. notify() either sees the waiter or the waiter sees
+// the change, so no wakeup is lost.
+template <uint32_t Spins = 1024>
+class park_wait {
+public:
+    template <class Ready>
+    bool wait(Ready ready, wait_clock::time_point deadline) {
+        for (uint32_t spins = 0; spins < Spins; ++spins) {
+            if (ready()) return true;
+            cpu_relax();
+        }
+        while (true) {
+            uint32_t seq = m_seq.load(std::memory_order_acquire);
+            m_waiters.fetch_add(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            bool done = ready();
+            if (!done) FutexWait(seq, deadline);
+            m_waiters.fetch_sub(1, std::memory_order_relaxed);
+            if (done || ready()) return true;
+            if (wait_clock::now() >= deadline) return false;
+        }
+    }
+
+    void notify() noexcept {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_waiters.load(std::memory_order_relaxed) == 0) return;
+        m_seq.fetch_add(1, std::memory_order_release);
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_seq),
+                FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+
+private:
+    void FutexWait(uint32_t seq, wait_clock::time_point deadline) {
+        timespec ts;
+        timespec* timeout = nullptr;
+        if (deadline != wait_clock::time_point::max()) {
+            int64_t left = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                               deadline - wait_clock::now())
+                               .count();
+            if (left <= 0) return;
+            ts.tv_sec  = static_cast<time_t>(left / 1000000000);
+            ts.tv_nsec = static_cast<long>(left % 1000000000);  // NOLINT
+            timeout    = &ts;
+        }
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_seq),
+                FUTEX_WAIT_PRIVATE, seq, timeout, nullptr, 0);
+    }
+
+private:
+    std::atomic<uint32_t> m_seq{0};
+    std::atomic<uint32_t> m_waiters{0};
+};
+
+}  // namespace cbase